@@ -3,22 +3,32 @@ SOURCES += \
     $$PWD/libyb/descriptor.cpp \
     $$PWD/libyb/stream_parser.cpp \
     $$PWD/libyb/tunnel.cpp \
+    $$PWD/libyb/async/buffered_stream.cpp \
     $$PWD/libyb/async/cancellation_token.cpp \
+    $$PWD/libyb/async/clock.cpp \
     $$PWD/libyb/async/descriptor_reader.cpp \
     $$PWD/libyb/async/device.cpp \
+    $$PWD/libyb/async/mapped_file_stream.cpp \
+    $$PWD/libyb/async/metered_stream.cpp \
     $$PWD/libyb/async/mock_stream.cpp \
     $$PWD/libyb/async/null_stream.cpp \
+    $$PWD/libyb/async/paced_stream.cpp \
+    $$PWD/libyb/async/recording_stream.cpp \
     $$PWD/libyb/async/stream.cpp \
     $$PWD/libyb/async/stream_device.cpp \
+    $$PWD/libyb/async/stream_pair.cpp \
+    $$PWD/libyb/async/tee_stream.cpp \
     $$PWD/libyb/async/timer.cpp \
     $$PWD/libyb/async/detail/parallel_composition_task.cpp \
     $$PWD/libyb/async/detail/task_impl.cpp \
     $$PWD/libyb/shupito/escape_sequence.cpp \
     $$PWD/libyb/shupito/flip2.cpp \
     $$PWD/libyb/usb/bulk_stream.cpp \
+    $$PWD/libyb/usb/detail/bulk_transfer_plan.cpp \
     $$PWD/libyb/usb/interface_guard.cpp \
     $$PWD/libyb/usb/usb_descriptors.cpp \
     $$PWD/libyb/usb/usb_device.cpp \
+    $$PWD/libyb/utils/buffer_chain.cpp \
     $$PWD/libyb/utils/ihex_file.cpp \
     $$PWD/libyb/utils/sparse_buffer.cpp \
     $$PWD/libyb/utils/svf_file.cpp \
@@ -41,6 +51,7 @@ win32 {
         $$PWD/libyb/usb/detail/usb_request_context.cpp \
         $$PWD/libyb/usb/detail/win32_usb_context.cpp \
         $$PWD/libyb/usb/detail/win32_usb_device.cpp \
+        $$PWD/libyb/utils/detail/win32_mapped_file.cpp \
         $$PWD/libyb/utils/detail/win32_file_operation.cpp \
         $$PWD/libyb/utils/detail/win32_overlapped.cpp
 }
@@ -50,12 +61,17 @@ unix:!macx:!symbian {
     SOURCES += \
         $$PWD/libyb/async/detail/linux_async_channel.cpp \
         $$PWD/libyb/async/detail/linux_async_runner.cpp \
+        $$PWD/libyb/async/detail/linux_embedded_runner.cpp \
+        $$PWD/libyb/async/detail/linux_fd_stream.cpp \
         $$PWD/libyb/async/detail/linux_serial_port.cpp \
+        $$PWD/libyb/async/detail/linux_socket_stream.cpp \
         $$PWD/libyb/async/detail/linux_sync_runner.cpp \
+        $$PWD/libyb/async/detail/linux_thread_pool.cpp \
         $$PWD/libyb/async/detail/linux_timer.cpp \
         $$PWD/libyb/async/detail/linux_wait_context.cpp \
         $$PWD/libyb/usb/detail/linux_usb_context.cpp \
         $$PWD/libyb/usb/detail/linux_usb_device.cpp \
+        $$PWD/libyb/utils/detail/linux_mapped_file.cpp \
         $$PWD/libyb/utils/detail/pthread_mutex.cpp
     LIBS += -ludev
 }
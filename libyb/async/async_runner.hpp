@@ -5,6 +5,9 @@
 #include "../utils/noncopyable.hpp"
 #include <memory>
 #include <utility>
+#include <functional>
+#include <typeinfo>
+#include <stdint.h>
 
 namespace yb {
 
@@ -24,12 +27,18 @@ public:
 
 	void mark_finished();
 	void wait();
+
+	// Completes on the runner that waits for it once the promise
+	// has finished. Cancelling the task forwards the cancellation
+	// to the promise; the task still waits for the promise to finish.
+	task<void> wait_task();
 	void cancel(cancel_level cl);
 	void perform_pending_cancels();
 
 	virtual void prepare_wait(task_wait_preparation_context & ctx) = 0;
 	virtual bool finish_wait(task_wait_finalization_context & ctx) throw() = 0;
 	virtual void cancel_and_wait() = 0;
+	virtual std::type_info const & task_type() const = 0;
 
 protected:
 	virtual void do_cancel(cancel_level cl) = 0;
@@ -70,6 +79,11 @@ public:
 		m_task.cancel_and_wait();
 	}
 
+	std::type_info const & task_type() const
+	{
+		return m_task.target_type();
+	}
+
 	bool has_result() const
 	{
 		return m_task.has_result();
@@ -181,6 +195,32 @@ public:
 		return this->wait();
 	}
 
+	// Moves the result into a task that can be waited for on another
+	// runner without blocking its thread. The future is left empty.
+	task<T> as_task()
+	{
+		if (!m_promise)
+			return async::result(this->wait());
+
+		try
+		{
+			detail::async_promise<T> * p = m_promise;
+			m_promise = 0;
+
+			std::shared_ptr<detail::async_promise<T> > promise(p, [](detail::async_promise<T> * p) {
+				p->release();
+			});
+
+			return promise->wait_task().then([promise] {
+				return async::result(promise->get());
+			});
+		}
+		catch (...)
+		{
+			return async::raise<T>();
+		}
+	}
+
 	T get()
 	{
 		return this->try_get().get();
@@ -202,6 +242,25 @@ private:
 	friend class async_runner;
 };
 
+// Describes a single call into a task that kept the dispatch thread
+// busy for longer than the watchdog threshold.
+struct async_runner_stall
+{
+	void const * promise;
+	char const * task_type;
+	uint64_t duration_us;
+};
+
+struct async_runner_metrics
+{
+	uint64_t iterations;
+	size_t promise_count;
+
+	uint64_t stall_count;
+	uint64_t longest_stall_us;
+	async_runner_stall last_stall;
+};
+
 class async_runner
 	: noncopyable
 {
@@ -209,6 +268,25 @@ public:
 	async_runner();
 	~async_runner();
 
+#ifndef _WIN32
+	// Starts a watchdog thread that detects when the dispatch thread
+	// spends more than `threshold_ms` inside a single `prepare_wait`,
+	// `finish_wait` or cancellation of a posted task. Each stall is
+	// counted in the metrics and reported to `on_stall` once,
+	// on the watchdog thread, while it is still in progress.
+	void enable_watchdog(int threshold_ms,
+		std::function<void (async_runner_stall const &)> const & on_stall = std::function<void (async_runner_stall const &)>());
+#endif
+
+	// Sets the number of synchronous steps tasks may take in one round
+	// before they yield; see `task_wait_preparation_context::set_budget`.
+	// Can be called from any thread.
+	void set_work_budget(size_t steps);
+
+	// Can be called from any thread. The stall counters stay zero
+	// unless the watchdog is enabled; it is only available on Linux.
+	async_runner_metrics metrics() const;
+
 	template <typename T>
 	async_future<T> post(task<T> && t)
 	{
@@ -0,0 +1,416 @@
+#include "buffered_stream.hpp"
+#include "clock.hpp"
+#include "detail/wait_context.hpp"
+#include <algorithm>
+using namespace yb;
+
+buffered_stream::ring::ring(size_t capacity)
+	: m_data(capacity), m_first(0), m_size(0)
+{
+	assert(capacity != 0);
+}
+
+buffer_ref buffered_stream::ring::front() const
+{
+	return buffer_ref(m_data.data() + m_first, (std::min)(m_size, m_data.size() - m_first));
+}
+
+void buffered_stream::ring::pop(size_t size)
+{
+	assert(size <= m_size);
+	m_first = (m_first + size) % m_data.size();
+	m_size -= size;
+
+	// An empty ring starts over, so that the next fill is contiguous.
+	if (m_size == 0)
+		m_first = 0;
+}
+
+size_t buffered_stream::ring::pop(uint8_t * buffer, size_t size)
+{
+	size_t res = 0;
+	while (res < size && m_size != 0)
+	{
+		buffer_ref chunk = this->front();
+		size_t len = (std::min)(chunk.size(), size - res);
+		std::copy(chunk.begin(), chunk.begin() + len, buffer + res);
+		this->pop(len);
+		res += len;
+	}
+	return res;
+}
+
+uint8_t * buffered_stream::ring::back(size_t & size)
+{
+	size_t last = m_first + m_size;
+	if (last >= m_data.size())
+	{
+		last -= m_data.size();
+		size = m_first - last;
+	}
+	else
+	{
+		size = m_data.size() - last;
+	}
+	return m_data.data() + last;
+}
+
+void buffered_stream::ring::push(size_t size)
+{
+	assert(m_size + size <= m_data.size());
+	m_size += size;
+}
+
+size_t buffered_stream::ring::push(uint8_t const * buffer, size_t size)
+{
+	size_t res = 0;
+	while (res < size && m_size != m_data.size())
+	{
+		size_t free;
+		uint8_t * p = this->back(free);
+		size_t len = (std::min)(free, size - res);
+		std::copy(buffer + res, buffer + res + len, p);
+		this->push(len);
+		res += len;
+	}
+	return res;
+}
+
+// Waits until `done` holds, driving the transfers in flight meanwhile.
+// A transfer is driven by the first pump to reach it; the other pumps
+// see its completion when their runner prepares them next.
+class buffered_stream::pump_task
+	: public task_base<void>
+{
+public:
+	pump_task(buffered_stream & s, bool (buffered_stream::*done)() const)
+		: m_s(s), m_done(done), m_cancelled(false)
+	{
+	}
+
+	~pump_task()
+	{
+		this->release();
+	}
+
+	void cancel(cancel_level cl) throw()
+	{
+		if (cl >= cl_abort)
+			m_cancelled = true;
+	}
+
+	task_result<void> cancel_and_wait() throw()
+	{
+		this->release();
+		if ((m_s.*m_done)())
+			return task_result<void>();
+		return task_result<void>(te_cancelled);
+	}
+
+	void prepare_wait(task_wait_preparation_context & ctx)
+	{
+		if (m_cancelled || (m_s.*m_done)())
+		{
+			ctx.set_finished();
+			return;
+		}
+
+		if (!ctx.probing() && m_s.flush_due() <= clock_now_us())
+			m_s.start_flush();
+
+		if (m_s.m_fill.has_task() && (m_s.m_fill_driver == 0 || m_s.m_fill_driver == this))
+		{
+			m_s.m_fill_driver = this;
+			task_wait_memento_builder mb(ctx);
+			m_s.m_fill.prepare_wait(ctx);
+			m_fill_memento = mb.finish();
+		}
+
+		if (m_s.m_flush.has_task() && (m_s.m_flush_driver == 0 || m_s.m_flush_driver == this))
+		{
+			m_s.m_flush_driver = this;
+			task_wait_memento_builder mb(ctx);
+			m_s.m_flush.prepare_wait(ctx);
+			m_flush_memento = mb.finish();
+		}
+
+		uint64_t due = m_s.flush_due();
+		if (due != task_wait_preparation_context::no_deadline)
+			ctx.add_deadline(due);
+	}
+
+	task<void> finish_wait(task_wait_finalization_context & ctx) throw()
+	{
+		if (m_s.m_fill_driver == this && ctx.contains(m_fill_memento))
+		{
+			m_s.m_fill.finish_wait(ctx);
+			if (m_s.m_fill.has_result())
+			{
+				m_s.m_fill_driver = 0;
+				m_s.collect_fill();
+			}
+		}
+
+		if (m_s.m_flush_driver == this && ctx.contains(m_flush_memento))
+		{
+			m_s.m_flush.finish_wait(ctx);
+			if (m_s.m_flush.has_result())
+			{
+				m_s.m_flush_driver = 0;
+				m_s.collect_flush();
+			}
+		}
+
+		if (m_cancelled)
+		{
+			this->release();
+			return async::fail<void>(te_cancelled);
+		}
+
+		if ((m_s.*m_done)())
+		{
+			this->release();
+			return async::value();
+		}
+
+		return nulltask;
+	}
+
+private:
+	void release()
+	{
+		if (m_s.m_fill_driver == this)
+			m_s.m_fill_driver = 0;
+		if (m_s.m_flush_driver == this)
+			m_s.m_flush_driver = 0;
+	}
+
+	buffered_stream & m_s;
+	bool (buffered_stream::*m_done)() const;
+	bool m_cancelled;
+	task_wait_memento m_fill_memento;
+	task_wait_memento m_flush_memento;
+};
+
+buffered_stream::buffered_stream(stream & s, size_t read_buffer_size, size_t write_buffer_size)
+	: m_stream(s), m_input(read_buffer_size), m_output(write_buffer_size),
+	m_write_threshold(write_buffer_size), m_write_delay_us(1000), m_output_since_us(0), m_flushing(0),
+	m_fill_driver(0), m_flush_driver(0)
+{
+}
+
+buffered_stream::~buffered_stream()
+{
+	// The transfers in flight refer to the buffers.
+	m_fill.clear();
+	m_flush.clear();
+}
+
+void buffered_stream::set_write_threshold(size_t bytes, uint64_t delay_us)
+{
+	m_write_threshold = bytes;
+	m_write_delay_us = delay_us;
+}
+
+size_t buffered_stream::buffered_input() const
+{
+	return m_input.size();
+}
+
+size_t buffered_stream::buffered_output() const
+{
+	return m_output.size();
+}
+
+bool buffered_stream::input_ready() const
+{
+	return m_input.size() != 0 || m_read_failure.has_exception();
+}
+
+bool buffered_stream::output_ready() const
+{
+	return m_output.size() < m_output.capacity() || m_write_failure.has_exception();
+}
+
+bool buffered_stream::output_written() const
+{
+	return m_flushing == 0 || m_write_failure.has_exception();
+}
+
+task<void> buffered_stream::pump(bool (buffered_stream::*done)() const)
+{
+	return protect([this, done] {
+		return task<void>(new pump_task(*this, done));
+	});
+}
+
+uint64_t buffered_stream::flush_due() const
+{
+	if (m_flushing != 0 || m_output.size() == 0 || m_write_failure.has_exception())
+		return task_wait_preparation_context::no_deadline;
+	if (m_output.size() >= m_write_threshold)
+		return 0;
+	if (m_write_delay_us >= task_wait_preparation_context::no_deadline - m_output_since_us)
+		return task_wait_preparation_context::no_deadline;
+	return m_output_since_us + m_write_delay_us;
+}
+
+void buffered_stream::start_fill()
+{
+	if (!m_fill.empty() || m_read_failure.has_exception())
+		return;
+
+	size_t size;
+	uint8_t * p = m_input.back(size);
+	if (size == 0)
+		return;
+
+	m_fill = m_stream.read(p, size).continue_with([this](task_result<size_t> r) -> task<void> {
+		if (r.has_exception())
+			return async::fail<void>(r);
+		m_input.push(r.get());
+		return async::value();
+	});
+
+	if (m_fill.has_result())
+		this->collect_fill();
+}
+
+void buffered_stream::collect_fill()
+{
+	task_result<void> r = m_fill.get_result();
+	m_fill.clear();
+	if (r.has_exception())
+		m_read_failure = std::move(r);
+}
+
+void buffered_stream::start_flush()
+{
+	if (m_flushing != 0 || m_output.size() == 0 || m_write_failure.has_exception())
+		return;
+
+	buffer_ref chunk = m_output.front();
+	m_flushing = chunk.size();
+	m_flush = m_stream.write_all(chunk.data(), chunk.size()).continue_with([this](task_result<void> r) -> task<void> {
+		if (r.has_exception())
+			return async::fail<void>(r);
+
+		m_output.pop(m_flushing);
+		m_output_since_us = clock_now_us();
+		return async::value();
+	});
+
+	if (m_flush.has_result())
+		this->collect_flush();
+}
+
+void buffered_stream::collect_flush()
+{
+	task_result<void> r = m_flush.get_result();
+	m_flush.clear();
+	m_flushing = 0;
+	if (r.has_exception())
+		m_write_failure = std::move(r);
+}
+
+task<size_t> buffered_stream::read(uint8_t * buffer, size_t size)
+{
+	if (size == 0 || m_input.size() != 0)
+	{
+		size_t r = m_input.pop(buffer, size);
+		this->start_fill();
+		return async::value(r);
+	}
+
+	if (m_read_failure.has_exception())
+	{
+		task_result<void> r = std::move(m_read_failure);
+		m_read_failure = task_result<void>();
+		return async::fail<size_t>(r);
+	}
+
+	this->start_flush();
+
+	if (size >= m_input.capacity() && m_fill.empty() && m_flush.empty())
+		return m_stream.read(buffer, size);
+
+	this->start_fill();
+	return this->pump(&buffered_stream::input_ready).then([this, buffer, size] {
+		return this->read(buffer, size);
+	});
+}
+
+task<buffer_ref> buffered_stream::peek()
+{
+	if (m_input.size() != 0)
+		return async::value(m_input.front());
+
+	if (m_read_failure.has_exception())
+	{
+		task_result<void> r = std::move(m_read_failure);
+		m_read_failure = task_result<void>();
+		return async::fail<buffer_ref>(r);
+	}
+
+	this->start_flush();
+	this->start_fill();
+	return this->pump(&buffered_stream::input_ready).then([this] {
+		return this->peek();
+	});
+}
+
+void buffered_stream::consume(size_t size)
+{
+	m_input.pop(size);
+	this->start_fill();
+}
+
+task<size_t> buffered_stream::write(uint8_t const * buffer, size_t size)
+{
+	if (m_write_failure.has_exception())
+	{
+		task_result<void> r = std::move(m_write_failure);
+		m_write_failure = task_result<void>();
+		return async::fail<size_t>(r);
+	}
+
+	if (size == 0)
+		return async::value((size_t)0);
+
+	if (m_output.size() == 0 && size >= m_output.capacity())
+		return m_stream.write(buffer, size);
+
+	if (m_output.size() == 0)
+		m_output_since_us = clock_now_us();
+
+	size_t r = m_output.push(buffer, size);
+	if (this->flush_due() <= clock_now_us())
+		this->start_flush();
+
+	if (r != 0)
+		return async::value(r);
+
+	// The buffer is full; wait for its head to be written out.
+	this->start_flush();
+	return this->pump(&buffered_stream::output_ready).then([this, buffer, size] {
+		return this->write(buffer, size);
+	});
+}
+
+task<void> buffered_stream::flush()
+{
+	if (m_write_failure.has_exception())
+	{
+		task_result<void> r = std::move(m_write_failure);
+		m_write_failure = task_result<void>();
+		return async::fail<void>(r);
+	}
+
+	if (m_output.size() == 0)
+		return async::value();
+
+	this->start_flush();
+	return this->pump(&buffered_stream::output_written).then([this] {
+		return this->flush();
+	});
+}
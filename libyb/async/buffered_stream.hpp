@@ -0,0 +1,112 @@
+#ifndef LIBYB_ASYNC_BUFFERED_STREAM_HPP
+#define LIBYB_ASYNC_BUFFERED_STREAM_HPP
+
+#include "stream.hpp"
+#include "../vector_ref.hpp"
+#include "../utils/noncopyable.hpp"
+#include <vector>
+
+namespace yb {
+
+// Wraps a stream with a read-ahead and a write-behind buffer.
+//
+// Whenever there is room in the read buffer, one read of the underlying
+// stream is kept in flight; it is waited for by the next `read` or `peek`
+// that finds the buffer empty. Reads at least as large as the buffer
+// bypass it while it's empty.
+//
+// Small writes are copied into the write buffer and complete right away.
+// The buffered data are written once the threshold set by
+// `set_write_threshold` is reached, when `flush` is called, or when
+// a read has to wait for input. A failed background write is reported
+// by the next `write` or `flush`, a failed read-ahead by the read
+// that finds the buffer empty. Unflushed data are discarded with
+// the stream.
+//
+// The transfers in flight are driven by whichever calls are waiting,
+// so a pending `read` keeps the output going and vice versa. At most
+// one read-side call (`read`, `peek`) and one write-side call (`write`,
+// `flush`) may be pending at a time, both within the same runner.
+class buffered_stream
+	: public stream, noncopyable
+{
+public:
+	explicit buffered_stream(stream & s, size_t read_buffer_size = 4096, size_t write_buffer_size = 4096);
+	~buffered_stream();
+
+	// Buffered output is written out once it reaches `bytes` or once
+	// the oldest buffered byte is `delay_us` old. The delay is only
+	// watched while a call on the stream is pending. Initially, output
+	// is written when the buffer fills up or after a millisecond.
+	void set_write_threshold(size_t bytes, uint64_t delay_us);
+
+	task<size_t> read(uint8_t * buffer, size_t size);
+	task<size_t> write(uint8_t const * buffer, size_t size);
+
+	// Waits for input and returns the longest contiguous run
+	// of buffered bytes. The bytes remain buffered until consumed.
+	task<buffer_ref> peek();
+	void consume(size_t size);
+
+	size_t buffered_input() const;
+	size_t buffered_output() const;
+
+	// Completes once all buffered output has been written.
+	task<void> flush();
+
+private:
+	class ring
+	{
+	public:
+		explicit ring(size_t capacity);
+
+		size_t size() const { return m_size; }
+		size_t capacity() const { return m_data.size(); }
+
+		buffer_ref front() const;
+		void pop(size_t size);
+		size_t pop(uint8_t * buffer, size_t size);
+
+		uint8_t * back(size_t & size);
+		void push(size_t size);
+		size_t push(uint8_t const * buffer, size_t size);
+
+	private:
+		std::vector<uint8_t> m_data;
+		size_t m_first;
+		size_t m_size;
+	};
+
+	class pump_task;
+
+	bool input_ready() const;
+	bool output_ready() const;
+	bool output_written() const;
+	task<void> pump(bool (buffered_stream::*done)() const);
+
+	void start_fill();
+	void start_flush();
+	void collect_fill();
+	void collect_flush();
+	uint64_t flush_due() const;
+
+	stream & m_stream;
+
+	ring m_input;
+	ring m_output;
+	size_t m_write_threshold;
+	uint64_t m_write_delay_us;
+	uint64_t m_output_since_us;
+	size_t m_flushing;
+
+	task<void> m_fill;
+	task<void> m_flush;
+	pump_task * m_fill_driver;
+	pump_task * m_flush_driver;
+	task_result<void> m_read_failure;
+	task_result<void> m_write_failure;
+};
+
+} // namespace yb
+
+#endif // LIBYB_ASYNC_BUFFERED_STREAM_HPP
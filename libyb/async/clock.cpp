@@ -0,0 +1,79 @@
+#include "clock.hpp"
+#include <chrono>
+#include <limits>
+using namespace yb;
+
+namespace {
+
+#ifdef _MSC_VER
+__declspec(thread) virtual_clock * g_current_clock = 0;
+#else
+__thread virtual_clock * g_current_clock = 0;
+#endif
+
+} // namespace
+
+virtual_clock::virtual_clock(uint64_t start_us)
+	: m_now_us(start_us)
+{
+}
+
+uint64_t virtual_clock::now_us() const
+{
+	return m_now_us;
+}
+
+void virtual_clock::advance_to(uint64_t time_us)
+{
+	if (time_us > m_now_us)
+		m_now_us = time_us;
+}
+
+void virtual_clock::advance_us(uint64_t duration_us)
+{
+	m_now_us += duration_us;
+}
+
+virtual_clock * virtual_clock::current()
+{
+	return g_current_clock;
+}
+
+virtual_clock_scope::virtual_clock_scope(virtual_clock & clock)
+	: m_prev(g_current_clock)
+{
+	g_current_clock = &clock;
+}
+
+virtual_clock_scope::~virtual_clock_scope()
+{
+	g_current_clock = m_prev;
+}
+
+uint64_t yb::clock_now_us()
+{
+	if (g_current_clock)
+		return g_current_clock->now_us();
+
+	return std::chrono::duration_cast<std::chrono::microseconds>(
+		std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+int yb::detail::deadline_timeout_ms(uint64_t deadline_us)
+{
+	if (deadline_us == std::numeric_limits<uint64_t>::max())
+		return -1;
+
+	// The runner advances a virtual clock itself once nothing is ready.
+	if (g_current_clock)
+		return 0;
+
+	uint64_t now = clock_now_us();
+	if (now >= deadline_us)
+		return 0;
+
+	uint64_t timeout_ms = (deadline_us - now + 999) / 1000;
+	if (timeout_ms > (uint64_t)std::numeric_limits<int>::max())
+		return std::numeric_limits<int>::max();
+	return (int)timeout_ms;
+}
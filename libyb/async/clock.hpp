@@ -0,0 +1,63 @@
+#ifndef LIBYB_ASYNC_CLOCK_HPP
+#define LIBYB_ASYNC_CLOCK_HPP
+
+#include "../utils/noncopyable.hpp"
+#include <stdint.h>
+
+namespace yb {
+
+// A simulated monotonic clock. While a `virtual_clock_scope` installs it
+// on a thread, timers started on that thread measure their deadlines
+// on the virtual clock instead of the system one, and a runner polling
+// on the thread advances the clock to the nearest deadline as soon as
+// no real I/O is ready. Waits then take no wall time at all.
+//
+// A `sync_runner` runs on its caller's thread and so picks up the clock;
+// timers must be started on the same thread that runs them.
+class virtual_clock
+	: noncopyable
+{
+public:
+	explicit virtual_clock(uint64_t start_us = 0);
+
+	uint64_t now_us() const;
+
+	// Moves the clock forward; the clock never goes back.
+	void advance_to(uint64_t time_us);
+	void advance_us(uint64_t duration_us);
+
+	// Returns the clock installed on the calling thread or null.
+	static virtual_clock * current();
+
+private:
+	uint64_t m_now_us;
+
+	friend class virtual_clock_scope;
+};
+
+class virtual_clock_scope
+	: noncopyable
+{
+public:
+	explicit virtual_clock_scope(virtual_clock & clock);
+	~virtual_clock_scope();
+
+private:
+	virtual_clock * m_prev;
+};
+
+// Returns the time on the calling thread's virtual clock if one
+// is installed, or the time on the system monotonic clock otherwise.
+uint64_t clock_now_us();
+
+namespace detail {
+
+// Returns the poll timeout in milliseconds that wakes the runner
+// no sooner than `deadline_us`, or -1 if there is no deadline.
+int deadline_timeout_ms(uint64_t deadline_us);
+
+} // namespace detail
+
+} // namespace yb
+
+#endif // LIBYB_ASYNC_CLOCK_HPP
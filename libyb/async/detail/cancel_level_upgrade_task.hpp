@@ -85,6 +85,10 @@ public:
 			return nulltask;
 
 		task_result<void> r = m_nested.get_result();
+		if (r.has_value())
+			return async::value();
+		if (r.has_error())
+			return m_catch_cancel && r.error() == te_cancelled? async::value(): async::result(std::move(r));
 
 		try
 		{
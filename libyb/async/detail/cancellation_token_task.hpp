@@ -119,6 +119,8 @@ public:
 	task_result<void> cancel_and_wait() throw()
 	{
 		task_result<void> r = m_core->m_task.cancel_and_wait();
+		if (m_catch_cancel && r.has_error() && r.error() == te_cancelled)
+			return task_result<void>();
 		if (m_catch_cancel && r.has_exception())
 		{
 			try
@@ -148,6 +150,8 @@ public:
 		if (m_core->m_task.has_result())
 		{
 			task_result<void> r = m_core->m_task.get_result();
+			if (m_catch_cancel && r.has_error() && r.error() == te_cancelled)
+				return async::value();
 			if (m_catch_cancel && r.has_exception())
 			{
 				try
@@ -56,7 +56,7 @@ public:
 		if (m_buffer)
 			return async::value();
 		else
-			return async::raise<void>(task_cancelled());
+			return async::fail<void>(te_cancelled);
 	}
 
 private:
@@ -96,7 +96,7 @@ public:
 	{
 		this->cancel(cl_kill);
 		assert(!m_buffer);
-		return std::make_exception_ptr(task_cancelled());
+		return task_result<T>(te_cancelled);
 	}
 
 	void prepare_wait(task_wait_preparation_context & ctx)
@@ -106,7 +106,7 @@ public:
 
 		if (!m_buffer)
 		{
-			m_result = async::raise<T>(task_cancelled());
+			m_result = async::fail<T>(te_cancelled);
 		}
 		else
 		{
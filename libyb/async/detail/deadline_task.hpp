@@ -0,0 +1,73 @@
+#ifndef LIBYB_ASYNC_DETAIL_DEADLINE_TASK_HPP
+#define LIBYB_ASYNC_DETAIL_DEADLINE_TASK_HPP
+
+#include "../task.hpp"
+#include "../clock.hpp"
+#include "wait_context.hpp"
+
+namespace yb {
+namespace detail {
+
+// Completes once `clock_now_us` reaches the deadline. The task owns
+// no poll item; it hands its deadline to the runner instead, which
+// either times its poll out or advances the thread's virtual clock.
+class deadline_task
+	: public task_base<void>
+{
+public:
+	explicit deadline_task(uint64_t deadline_us)
+		: m_deadline_us(deadline_us), m_cancelled(false)
+	{
+	}
+
+	void cancel(cancel_level cl) throw()
+	{
+		if (cl >= cl_abort)
+			m_cancelled = true;
+	}
+
+	task_result<void> cancel_and_wait() throw()
+	{
+		if (clock_now_us() >= m_deadline_us)
+			return task_result<void>();
+		return task_result<void>(te_cancelled);
+	}
+
+	void prepare_wait(task_wait_preparation_context & ctx)
+	{
+		if (m_cancelled || clock_now_us() >= m_deadline_us)
+			ctx.set_finished();
+		else
+			ctx.add_deadline(m_deadline_us);
+	}
+
+	task<void> finish_wait(task_wait_finalization_context &) throw()
+	{
+		if (clock_now_us() >= m_deadline_us)
+			return async::value();
+		if (m_cancelled)
+			return async::fail<void>(te_cancelled);
+		return nulltask;
+	}
+
+private:
+	uint64_t m_deadline_us;
+	bool m_cancelled;
+};
+
+inline task<void> make_deadline_task(uint64_t deadline_us)
+{
+	try
+	{
+		return task<void>(new deadline_task(deadline_us));
+	}
+	catch (...)
+	{
+		return async::raise<void>();
+	}
+}
+
+} // namespace detail
+} // namespace yb
+
+#endif // LIBYB_ASYNC_DETAIL_DEADLINE_TASK_HPP
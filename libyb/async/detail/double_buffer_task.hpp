@@ -63,7 +63,7 @@ public:
 		{
 			size_t idx = (m_head + i) % m_task_count;
 
-			task_wait_memento_builder b(ctx);
+			task_wait_memento_builder b(ctx, idx);
 			m_tasks[idx].t.prepare_wait(ctx);
 			m_tasks[idx].m = b.finish();
 		}
@@ -71,11 +71,21 @@ public:
 
 	task<void> finish_wait(task_wait_finalization_context & ctx) throw() override
 	{
-		for (size_t i = 0; i < m_active_tasks; ++i)
+		task_wait_route_step step(ctx);
+		size_t slot = step.slot();
+
+		if (slot < m_task_count && m_tasks[slot].t.has_task() && ctx.contains(m_tasks[slot].m))
 		{
-			size_t idx = (m_head + i) % m_task_count;
-			if (ctx.contains(m_tasks[idx].m))
-				m_tasks[idx].t.finish_wait(ctx);
+			m_tasks[slot].t.finish_wait(ctx);
+		}
+		else
+		{
+			for (size_t i = 0; i < m_active_tasks; ++i)
+			{
+				size_t idx = (m_head + i) % m_task_count;
+				if (ctx.contains(m_tasks[idx].m))
+					m_tasks[idx].t.finish_wait(ctx);
+			}
 		}
 
 		this->collect();
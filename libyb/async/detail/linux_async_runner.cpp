@@ -1,11 +1,16 @@
 #include "../async_runner.hpp"
+#include "../clock.hpp"
 #include "linux_wait_context.hpp"
+#include "linux_fdpoll_task.hpp"
 #include "../../utils/noncopyable.hpp"
+#include "../../utils/detail/scoped_unix_fd.hpp"
 #include <list>
+#include <vector>
 #include <stdexcept>
 #include <pthread.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <time.h>
 #include <sys/poll.h>
 #include <sys/eventfd.h>
 using namespace yb;
@@ -15,7 +20,7 @@ struct async_promise_base::impl
 	: noncopyable
 {
 	explicit impl(async_runner * runner)
-		: m_runner(runner), m_refcount(1), m_finished(false)
+		: m_runner(runner), m_refcount(1), m_finished(false), m_request_cl(cl_none), m_applied_cl(cl_none)
 	{
 		if (pthread_mutex_init(&m_mutex, 0) != 0)
 			throw std::runtime_error("cannot create mutex");
@@ -40,6 +45,9 @@ struct async_promise_base::impl
 	pthread_cond_t m_cond;
 	bool m_finished;
 
+	// Created by the first `wait_task` and signalled once finished.
+	scoped_unix_fd m_finished_event;
+
 	cancel_level m_request_cl;
 	cancel_level m_applied_cl;
 };
@@ -69,7 +77,41 @@ void async_promise_base::mark_finished()
 	pthread_mutex_lock(&m_pimpl->m_mutex);
 	m_pimpl->m_finished = true;
 	pthread_cond_broadcast(&m_pimpl->m_cond);
+
+	if (!m_pimpl->m_finished_event.empty())
+	{
+		uint64_t val = 1;
+		int r = write(m_pimpl->m_finished_event.get(), &val, sizeof val);
+		assert(r != -1);
+		(void)r;
+	}
+
+	pthread_mutex_unlock(&m_pimpl->m_mutex);
+}
+
+task<void> async_promise_base::wait_task()
+{
+	pthread_mutex_lock(&m_pimpl->m_mutex);
+	bool finished = m_pimpl->m_finished;
+	if (!finished && m_pimpl->m_finished_event.empty())
+		m_pimpl->m_finished_event.reset(eventfd(0, EFD_NONBLOCK));
+	int fd = m_pimpl->m_finished_event.get();
 	pthread_mutex_unlock(&m_pimpl->m_mutex);
+
+	if (finished)
+		return async::value();
+	if (fd == -1)
+		throw std::runtime_error("cannot create eventfd");
+
+	this->addref();
+	std::shared_ptr<async_promise_base> self(this, [](async_promise_base * p) {
+		p->release();
+	});
+
+	return make_linux_pollfd_task(fd, POLLIN, [self](cancel_level cl) {
+		self->cancel(cl);
+		return true;
+	}).ignore_result();
 }
 
 void async_promise_base::wait()
@@ -136,13 +178,28 @@ struct scoped_mutex
 	pthread_mutex_t * m_mutex;
 };
 
+uint64_t monotonic_us()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
 } // namespace
 
 struct async_runner::impl
 {
 	impl()
-		: stopped(false)
+		: stopped(false), watchdog_running(false), watchdog_threshold_us(0),
+		busy_since_us(0), busy_promise(0), busy_type(0), iterations(0), promise_count(0),
+		work_budget(task_wait_preparation_context::default_budget)
 	{
+		stats.stall_count = 0;
+		stats.longest_stall_us = 0;
+		stats.last_stall.promise = 0;
+		stats.last_stall.task_type = 0;
+		stats.last_stall.duration_us = 0;
+
 		if (pthread_mutex_init(&mutex, 0) != 0)
 			throw std::runtime_error("failed to create a mutex");
 
@@ -163,6 +220,12 @@ struct async_runner::impl
 
 	~impl()
 	{
+		if (watchdog_running)
+		{
+			pthread_cond_destroy(&watchdog_cond);
+			pthread_mutex_destroy(&watchdog_mutex);
+		}
+
 		close(control_event);
 		pthread_mutex_destroy(&mutex);
 	}
@@ -172,82 +235,247 @@ struct async_runner::impl
 		task_wait_preparation_context wait_ctx;
 		task_wait_preparation_context_impl & wait_ctx_impl = *wait_ctx.get();
 
+		// Rounds that only finish ready tasks alternate with rounds
+		// that poll, so that ready tasks can't hold back I/O.
+		bool poll_due = false;
+
 		while (!__atomic_load_n(&stopped, __ATOMIC_ACQUIRE))
 		{
+			wait_ctx.set_budget(__atomic_load_n(&work_budget, __ATOMIC_RELAXED));
 			wait_ctx.clear();
+			__atomic_store_n(&iterations, iterations + 1, __ATOMIC_RELAXED);
+			__atomic_store_n(&promise_count, promises.size(), __ATOMIC_RELAXED);
 
 			for (std::list<parallel_promise>::iterator it = promises.begin(); it != promises.end(); ++it)
+			{
+				watched_call wc(*this, it->promise);
 				it->promise->perform_pending_cancels();
+			}
 
+			promise_slots.clear();
 			for (std::list<parallel_promise>::iterator it = promises.begin(); it != promises.end(); ++it)
 			{
 				assert(it->promise != 0);
 
-				task_wait_memento_builder mb(wait_ctx);
+				watched_call wc(*this, it->promise);
+				task_wait_memento_builder mb(wait_ctx, promise_slots.size());
+				promise_slots.push_back(it);
 				it->promise->prepare_wait(wait_ctx);
 				it->m = mb.finish();
 			}
 
-			if (wait_ctx_impl.m_finished_tasks)
+			if (wait_ctx_impl.m_finished_tasks && !poll_due)
 			{
-				task_wait_finalization_context finish_ctx;
-				finish_ctx.prep_ctx = &wait_ctx;
-				finish_ctx.finished_tasks = wait_ctx_impl.m_finished_tasks;
-				this->finish_wait(finish_ctx);
+				this->finish_ready(wait_ctx);
+				poll_due = true;
+				continue;
 			}
-			else
-			{
-				struct pollfd pfd = {};
-				pfd.fd = control_event;
-				pfd.events = POLLIN;
-				wait_ctx_impl.m_pollfds.push_back(pfd);
 
-				int r = poll(wait_ctx_impl.m_pollfds.data(), wait_ctx_impl.m_pollfds.size(), -1);
-				assert(r > 0);
+			poll_due = false;
 
-				if (wait_ctx_impl.m_pollfds.back().revents & POLLIN)
-				{
-					uint64_t val;
-					int r = read(control_event, &val, sizeof val);
-					assert(r >= 0);
+			struct pollfd pfd = {};
+			pfd.fd = control_event;
+			pfd.events = POLLIN;
+			wait_ctx_impl.add_pollfd(pfd, 0);
 
-					scoped_mutex l(mutex);
-					promises.splice(promises.end(), new_promises);
-					continue;
-				}
+			int timeout = wait_ctx_impl.m_finished_tasks? 0: detail::deadline_timeout_ms(wait_ctx.deadline());
+			int r = poll(wait_ctx_impl.m_pollfds.data(), wait_ctx_impl.m_pollfds.size(), timeout);
+			assert(r >= 0);
+
+			if (r == 0)
+			{
+				if (wait_ctx_impl.m_finished_tasks)
+					this->finish_ready(wait_ctx);
+				continue;
+			}
+
+			if (wait_ctx_impl.m_pollfds.back().revents & POLLIN)
+			{
+				uint64_t val;
+				int r = read(control_event, &val, sizeof val);
+				assert(r >= 0);
+
+				scoped_mutex l(mutex);
+				promises.splice(promises.end(), new_promises);
+				continue;
+			}
 
-				for (size_t i = 0; i < wait_ctx_impl.m_pollfds.size() - 1; ++i)
+			for (size_t i = 0; i < wait_ctx_impl.m_pollfds.size() - 1; ++i)
+			{
+				if (wait_ctx_impl.m_pollfds[i].revents)
 				{
-					if (wait_ctx_impl.m_pollfds[i].revents)
-					{
-						task_wait_finalization_context finish_ctx;
-						finish_ctx.prep_ctx = &wait_ctx;
-						finish_ctx.finished_tasks = false;
-						finish_ctx.selected_poll_item = i;
-						this->finish_wait(finish_ctx);
-						break;
-					}
+					task_wait_finalization_context finish_ctx;
+					finish_ctx.prep_ctx = &wait_ctx;
+					finish_ctx.finished_tasks = false;
+					finish_ctx.selected_poll_item = i;
+					this->finish_wait(finish_ctx);
+					break;
 				}
 			}
 		}
 	}
 
+	void finish_ready(task_wait_preparation_context & wait_ctx)
+	{
+		task_wait_finalization_context finish_ctx;
+		finish_ctx.prep_ctx = &wait_ctx;
+		finish_ctx.finished_tasks = wait_ctx.get()->m_finished_tasks;
+		this->finish_wait(finish_ctx);
+	}
+
 	void finish_wait(task_wait_finalization_context & ctx)
 	{
+		task_wait_route_step step(ctx);
+		if (step.slot() < promise_slots.size() && ctx.contains(promise_slots[step.slot()]->m))
+		{
+			this->finish_promise(ctx, promise_slots[step.slot()]);
+			return;
+		}
+
 		for (std::list<parallel_promise>::iterator it = promises.begin(); it != promises.end(); )
 		{
-			if (ctx.contains(it->m) && it->promise->finish_wait(ctx))
+			std::list<parallel_promise>::iterator cur = it++;
+			if (ctx.contains(cur->m))
+				this->finish_promise(ctx, cur);
+		}
+	}
+
+	void finish_promise(task_wait_finalization_context & ctx, std::list<parallel_promise>::iterator it)
+	{
+		bool finished;
+		{
+			watched_call wc(*this, it->promise);
+			finished = it->promise->finish_wait(ctx);
+		}
+
+		if (finished)
+		{
+			it->promise->mark_finished();
+			promises.erase(it);
+		}
+	}
+
+	// Marks the dispatch thread as busy inside a call into a promise
+	// for the watchdog to observe.
+	struct watched_call
+		: noncopyable
+	{
+		watched_call(impl & runner, async_promise_base * promise)
+			: m_runner(__atomic_load_n(&runner.watchdog_threshold_us, __ATOMIC_RELAXED)? &runner: 0)
+		{
+			if (m_runner)
 			{
-				it->promise->mark_finished();
-				it = promises.erase(it);
+				__atomic_store_n(&m_runner->busy_promise, promise, __ATOMIC_RELAXED);
+				__atomic_store_n(&m_runner->busy_type, &promise->task_type(), __ATOMIC_RELAXED);
+				__atomic_store_n(&m_runner->busy_since_us, monotonic_us(), __ATOMIC_RELEASE);
 			}
-			else
+		}
+
+		~watched_call()
+		{
+			if (!m_runner)
+				return;
+
+			uint64_t since = m_runner->busy_since_us;
+			__atomic_store_n(&m_runner->busy_since_us, 0, __ATOMIC_RELEASE);
+
+			uint64_t duration = monotonic_us() - since;
+			if (duration >= __atomic_load_n(&m_runner->watchdog_threshold_us, __ATOMIC_RELAXED))
 			{
-				++it;
+				scoped_mutex l(m_runner->watchdog_mutex);
+				if (m_runner->stats.longest_stall_us < duration)
+					m_runner->stats.longest_stall_us = duration;
+			}
+		}
+
+		impl * m_runner;
+	};
+
+	void run_watchdog()
+	{
+		uint64_t reported_since = 0;
+
+		scoped_mutex l(watchdog_mutex);
+		while (!__atomic_load_n(&stopped, __ATOMIC_ACQUIRE))
+		{
+			uint64_t threshold_us = __atomic_load_n(&watchdog_threshold_us, __ATOMIC_ACQUIRE);
+			uint64_t period_us = threshold_us / 4;
+			if (period_us < 1000)
+				period_us = 1000;
+
+			struct timespec deadline;
+			clock_gettime(CLOCK_MONOTONIC, &deadline);
+			deadline.tv_sec += period_us / 1000000;
+			deadline.tv_nsec += (period_us % 1000000) * 1000;
+			if (deadline.tv_nsec >= 1000000000)
+			{
+				++deadline.tv_sec;
+				deadline.tv_nsec -= 1000000000;
+			}
+
+			pthread_cond_timedwait(&watchdog_cond, &watchdog_mutex, &deadline);
+
+			uint64_t since = __atomic_load_n(&busy_since_us, __ATOMIC_ACQUIRE);
+			if (!since || since == reported_since)
+				continue;
+
+			uint64_t now = monotonic_us();
+			if (!threshold_us || now - since < threshold_us)
+				continue;
+
+			async_runner_stall stall;
+			stall.promise = __atomic_load_n(&busy_promise, __ATOMIC_RELAXED);
+			std::type_info const * type = __atomic_load_n(&busy_type, __ATOMIC_RELAXED);
+
+			// The call might have finished while we were looking.
+			if (__atomic_load_n(&busy_since_us, __ATOMIC_ACQUIRE) != since)
+				continue;
+
+			reported_since = since;
+			stall.task_type = type->name();
+			stall.duration_us = now - since;
+
+			++stats.stall_count;
+			if (stats.longest_stall_us < stall.duration_us)
+				stats.longest_stall_us = stall.duration_us;
+			stats.last_stall = stall;
+
+			if (on_stall)
+			{
+				std::function<void (async_runner_stall const &)> hook = on_stall;
+				pthread_mutex_unlock(&watchdog_mutex);
+				try
+				{
+					hook(stall);
+				}
+				catch (...)
+				{
+				}
+				pthread_mutex_lock(&watchdog_mutex);
 			}
 		}
 	}
 
+	static void * watchdog_thread_fn(void * ctx)
+	{
+		impl * pimpl = (impl *)ctx;
+		pimpl->run_watchdog();
+		return 0;
+	}
+
+	void stop_watchdog()
+	{
+		if (!watchdog_running)
+			return;
+
+		pthread_mutex_lock(&watchdog_mutex);
+		pthread_cond_broadcast(&watchdog_cond);
+		pthread_mutex_unlock(&watchdog_mutex);
+
+		void * retval;
+		pthread_join(watchdog_thread, &retval);
+	}
+
 	static void * dispatch_thread(void * ctx)
 	{
 		impl * pimpl = (impl *)ctx;
@@ -273,10 +501,30 @@ struct async_runner::impl
 	pthread_mutex_t mutex;
 	std::list<parallel_promise> promises;
 	std::list<parallel_promise> new_promises;
+
+	// The promises in the order they were prepared in this round;
+	// indexed by the slots recorded in the wait context's route table.
+	std::vector<std::list<parallel_promise>::iterator> promise_slots;
 	bool stopped;
 
 	pthread_t thread;
 	int control_event;
+
+	bool watchdog_running;
+	pthread_t watchdog_thread;
+	pthread_mutex_t watchdog_mutex;
+	pthread_cond_t watchdog_cond;
+	uint64_t watchdog_threshold_us;
+	std::function<void (async_runner_stall const &)> on_stall;
+
+	uint64_t busy_since_us;
+	async_promise_base * busy_promise;
+	std::type_info const * busy_type;
+
+	uint64_t iterations;
+	size_t promise_count;
+	async_runner_metrics stats;
+	size_t work_budget;
 };
 
 async_runner::async_runner()
@@ -293,6 +541,72 @@ async_runner::~async_runner()
 
 	void * retval;
 	pthread_join(m_pimpl->thread, &retval);
+
+	m_pimpl->stop_watchdog();
+}
+
+void async_runner::enable_watchdog(int threshold_ms, std::function<void (async_runner_stall const &)> const & on_stall)
+{
+	assert(threshold_ms > 0);
+
+	if (m_pimpl->watchdog_running)
+	{
+		scoped_mutex l(m_pimpl->watchdog_mutex);
+		m_pimpl->on_stall = on_stall;
+		__atomic_store_n(&m_pimpl->watchdog_threshold_us, (uint64_t)threshold_ms * 1000, __ATOMIC_RELAXED);
+		return;
+	}
+
+	pthread_condattr_t attr;
+	if (pthread_condattr_init(&attr) != 0)
+		throw std::runtime_error("failed to create a condvar");
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+
+	if (pthread_mutex_init(&m_pimpl->watchdog_mutex, 0) != 0)
+	{
+		pthread_condattr_destroy(&attr);
+		throw std::runtime_error("failed to create a mutex");
+	}
+
+	int r = pthread_cond_init(&m_pimpl->watchdog_cond, &attr);
+	pthread_condattr_destroy(&attr);
+	if (r != 0)
+	{
+		pthread_mutex_destroy(&m_pimpl->watchdog_mutex);
+		throw std::runtime_error("failed to create a condvar");
+	}
+
+	m_pimpl->on_stall = on_stall;
+
+	if (pthread_create(&m_pimpl->watchdog_thread, 0, &impl::watchdog_thread_fn, m_pimpl.get()) != 0)
+	{
+		pthread_cond_destroy(&m_pimpl->watchdog_cond);
+		pthread_mutex_destroy(&m_pimpl->watchdog_mutex);
+		throw std::runtime_error("failed to create a watchdog thread");
+	}
+
+	m_pimpl->watchdog_running = true;
+	__atomic_store_n(&m_pimpl->watchdog_threshold_us, (uint64_t)threshold_ms * 1000, __ATOMIC_RELEASE);
+}
+
+void async_runner::set_work_budget(size_t steps)
+{
+	__atomic_store_n(&m_pimpl->work_budget, steps, __ATOMIC_RELAXED);
+}
+
+async_runner_metrics async_runner::metrics() const
+{
+	async_runner_metrics res = {};
+
+	if (m_pimpl->watchdog_running)
+	{
+		scoped_mutex l(m_pimpl->watchdog_mutex);
+		res = m_pimpl->stats;
+	}
+
+	res.iterations = __atomic_load_n(&m_pimpl->iterations, __ATOMIC_RELAXED);
+	res.promise_count = __atomic_load_n(&m_pimpl->promise_count, __ATOMIC_RELAXED);
+	return res;
 }
 
 async_runner::submit_context::submit_context(async_runner & runner)
@@ -0,0 +1,276 @@
+#include "../embedded_runner.hpp"
+#include "../clock.hpp"
+#include "linux_wait_context.hpp"
+#include "../../utils/detail/scoped_unix_fd.hpp"
+#include <map>
+#include <stdexcept>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+using namespace yb;
+using namespace yb::detail;
+
+struct embedded_runner::impl
+{
+	scoped_unix_fd epoll_fd;
+
+	// Kept readable while some task finished without waiting.
+	scoped_unix_fd ready_event;
+
+	// Armed to the earliest deadline of the prepared wait.
+	scoped_unix_fd deadline_timer;
+	uint64_t armed_deadline;
+
+	task<void> tasks;
+	task_wait_preparation_context wait_ctx;
+	size_t work_budget;
+
+	// Set after a dispatch that only finished ready tasks;
+	// the next one polls for I/O even if some tasks are ready again.
+	bool poll_due;
+
+	// The events each descriptor is currently registered for
+	// and the newest of the waiters it was registered for.
+	struct registration
+	{
+		uint32_t events;
+		uint64_t waiter_id;
+	};
+
+	std::map<int, registration> registered;
+
+	void add_internal(int fd)
+	{
+		struct epoll_event ev = {};
+		ev.events = EPOLLIN;
+		ev.data.fd = fd;
+		if (epoll_ctl(epoll_fd.get(), EPOLL_CTL_ADD, fd, &ev) == -1)
+			throw std::runtime_error("cannot register with epoll");
+	}
+
+	void drain(int fd)
+	{
+		uint64_t val;
+		while (read(fd, &val, sizeof val) == sizeof val)
+		{
+		}
+	}
+
+	void prepare()
+	{
+		// The deadline timer runs on the system clock.
+		assert(!virtual_clock::current());
+
+		task_wait_preparation_context_impl & wait_ctx_impl = *wait_ctx.get();
+
+		wait_ctx.set_budget(work_budget);
+		wait_ctx.clear();
+		tasks.prepare_wait(wait_ctx);
+
+		// Descriptors that epoll can't watch are polled
+		// by the next dispatch.
+		bool all_watched = this->update_registrations();
+
+		if (wait_ctx_impl.m_finished_tasks || !all_watched)
+		{
+			uint64_t val = 1;
+			int r = write(ready_event.get(), &val, sizeof val);
+			assert(r == sizeof val);
+			(void)r;
+		}
+
+		this->arm_deadline(wait_ctx.deadline());
+	}
+
+	void finish_ready()
+	{
+		task_wait_finalization_context finish_ctx;
+		finish_ctx.prep_ctx = &wait_ctx;
+		finish_ctx.finished_tasks = wait_ctx.get()->m_finished_tasks;
+		tasks.finish_wait(finish_ctx);
+	}
+
+	// Brings the epoll set in line with the prepared poll items.
+	// Descriptors are level-triggered, so one that stays ready keeps
+	// the epoll fd readable until its task consumes the event.
+	//
+	// A descriptor is only touched if its events or waiters changed.
+	// A descriptor number may have been closed and reused since
+	// the last round, which silently drops its registration, but the new
+	// descriptor comes with a new waiter, so it is modified, or added
+	// if epoll doesn't know it. Returns false if some descriptor can't
+	// be watched by epoll at all, e.g. a regular file; `poll` reports
+	// on those to their tasks.
+	bool update_registrations()
+	{
+		task_wait_preparation_context_impl & wait_ctx_impl = *wait_ctx.get();
+
+		std::map<int, registration> wanted;
+		for (size_t i = 0; i < wait_ctx_impl.m_pollfds.size(); ++i)
+		{
+			registration & reg = wanted[wait_ctx_impl.m_pollfds[i].fd];
+			reg.events |= (uint16_t)wait_ctx_impl.m_pollfds[i].events;
+			if (reg.waiter_id < wait_ctx_impl.m_waiter_ids[i])
+				reg.waiter_id = wait_ctx_impl.m_waiter_ids[i];
+		}
+
+		for (std::map<int, registration>::const_iterator it = registered.begin(); it != registered.end(); ++it)
+		{
+			if (wanted.find(it->first) == wanted.end())
+				epoll_ctl(epoll_fd.get(), EPOLL_CTL_DEL, it->first, 0);
+		}
+
+		bool all_watched = true;
+		for (std::map<int, registration>::iterator it = wanted.begin(); it != wanted.end(); )
+		{
+			std::map<int, registration>::const_iterator prev = registered.find(it->first);
+			if (prev != registered.end() && prev->second.events == it->second.events
+				&& prev->second.waiter_id == it->second.waiter_id)
+			{
+				++it;
+				continue;
+			}
+
+			struct epoll_event ev = {};
+			ev.events = it->second.events;
+			ev.data.fd = it->first;
+
+			if (epoll_ctl(epoll_fd.get(), EPOLL_CTL_MOD, it->first, &ev) == -1
+				&& (errno != ENOENT || epoll_ctl(epoll_fd.get(), EPOLL_CTL_ADD, it->first, &ev) == -1))
+			{
+				all_watched = false;
+				wanted.erase(it++);
+			}
+			else
+			{
+				++it;
+			}
+		}
+
+		registered.swap(wanted);
+		return all_watched;
+	}
+
+	void arm_deadline(uint64_t deadline_us)
+	{
+		if (deadline_us == armed_deadline)
+			return;
+
+		struct itimerspec ts = {};
+		if (deadline_us != task_wait_preparation_context::no_deadline)
+		{
+			ts.it_value.tv_sec = deadline_us / 1000000;
+			ts.it_value.tv_nsec = (deadline_us % 1000000) * 1000;
+			if (ts.it_value.tv_sec == 0 && ts.it_value.tv_nsec == 0)
+				ts.it_value.tv_nsec = 1;
+		}
+
+		timerfd_settime(deadline_timer.get(), TFD_TIMER_ABSTIME, &ts, 0);
+		armed_deadline = deadline_us;
+	}
+};
+
+embedded_runner::embedded_runner()
+	: m_pimpl(new impl())
+{
+	m_pimpl->armed_deadline = task_wait_preparation_context::no_deadline;
+	m_pimpl->work_budget = task_wait_preparation_context::default_budget;
+	m_pimpl->poll_due = false;
+
+	m_pimpl->epoll_fd.reset(epoll_create1(EPOLL_CLOEXEC));
+	if (m_pimpl->epoll_fd.empty())
+		throw std::runtime_error("cannot create epoll fd");
+
+	m_pimpl->ready_event.reset(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC));
+	if (m_pimpl->ready_event.empty())
+		throw std::runtime_error("cannot create eventfd");
+
+	// `clock_now_us` measures the system time on CLOCK_MONOTONIC.
+	m_pimpl->deadline_timer.reset(timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC));
+	if (m_pimpl->deadline_timer.empty())
+		throw std::runtime_error("cannot create timerfd");
+
+	m_pimpl->add_internal(m_pimpl->ready_event.get());
+	m_pimpl->add_internal(m_pimpl->deadline_timer.get());
+}
+
+embedded_runner::~embedded_runner()
+{
+	m_pimpl->tasks.clear();
+}
+
+int embedded_runner::native_handle() const
+{
+	return m_pimpl->epoll_fd.get();
+}
+
+bool embedded_runner::empty() const
+{
+	return !m_pimpl->tasks.has_task();
+}
+
+void embedded_runner::set_work_budget(size_t steps)
+{
+	m_pimpl->work_budget = steps;
+}
+
+void embedded_runner::cancel(cancel_level cl)
+{
+	m_pimpl->tasks.cancel(cl);
+	m_pimpl->prepare();
+}
+
+void embedded_runner::post_task(task<void> && t)
+{
+	m_pimpl->tasks |= std::move(t);
+	m_pimpl->prepare();
+}
+
+void embedded_runner::dispatch_ready()
+{
+	impl & pimpl = *m_pimpl;
+	task_wait_preparation_context_impl & wait_ctx_impl = *pimpl.wait_ctx.get();
+
+	pimpl.drain(pimpl.ready_event.get());
+	pimpl.drain(pimpl.deadline_timer.get());
+
+	if (!pimpl.tasks.has_task())
+		return;
+
+	// Tasks waiting for a deadline that has passed only report
+	// themselves finished once they are prepared again.
+	if (!wait_ctx_impl.m_finished_tasks && pimpl.wait_ctx.deadline() <= clock_now_us())
+		pimpl.prepare();
+
+	if (wait_ctx_impl.m_finished_tasks && !pimpl.poll_due)
+	{
+		pimpl.finish_ready();
+		pimpl.poll_due = true;
+	}
+	else
+	{
+		pimpl.poll_due = false;
+
+		int r = poll(wait_ctx_impl.m_pollfds.data(), wait_ctx_impl.m_pollfds.size(), 0);
+		if (r <= 0 && wait_ctx_impl.m_finished_tasks)
+			pimpl.finish_ready();
+
+		for (size_t i = 0; r > 0 && pimpl.tasks.has_task() && i < wait_ctx_impl.m_pollfds.size(); ++i)
+		{
+			if (wait_ctx_impl.m_pollfds[i].revents)
+			{
+				task_wait_finalization_context finish_ctx;
+				finish_ctx.prep_ctx = &pimpl.wait_ctx;
+				finish_ctx.finished_tasks = false;
+				finish_ctx.selected_poll_item = i;
+				pimpl.tasks.finish_wait(finish_ctx);
+
+				--r;
+			}
+		}
+	}
+
+	pimpl.prepare();
+}
@@ -0,0 +1,424 @@
+#include "../fd_stream.hpp"
+#include "linux_fdpoll_task.hpp"
+#include <stdexcept>
+#include <algorithm>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+using namespace yb;
+using namespace yb::detail;
+
+namespace {
+
+void set_nonblocking(int fd)
+{
+	int flags = fcntl(fd, F_GETFL);
+	if (flags == -1 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) == -1)
+		throw std::runtime_error("cannot set O_NONBLOCK");
+}
+
+bool is_socket(int fd)
+{
+	struct stat st;
+	return fstat(fd, &st) == 0 && S_ISSOCK(st.st_mode);
+}
+
+// Failures that mean the other side is gone rather than the call
+// having gone wrong; a tty whose device was unplugged or a pty master
+// whose slave was closed report EIO.
+template <typename R>
+task<R> io_error(char const * msg)
+{
+	switch (errno)
+	{
+	case EPIPE:
+	case ECONNRESET:
+		return async::fail<R>(te_eof);
+	case EIO:
+	case ENXIO:
+	case ENODEV:
+		return async::fail<R>(te_device_gone);
+	default:
+		return async::raise<R>(std::runtime_error(msg));
+	}
+}
+
+bool keep_polling(cancel_level cl)
+{
+	return cl < cl_abort;
+}
+
+// Turns the return value of a non-blocking transfer into its result,
+// or into an empty task if the descriptor isn't ready. A zero-byte
+// read is the end of the stream unless nothing was asked for.
+task<size_t> io_result(ssize_t r, bool zero_ok, char const * msg)
+{
+	if (r > 0 || (r == 0 && zero_ok))
+		return async::value((size_t)r);
+	if (r == 0)
+		return async::fail<size_t>(te_eof);
+	if (errno == EAGAIN || errno == EWOULDBLOCK)
+		return task<size_t>();
+	return io_error<size_t>(msg);
+}
+
+// Polls the descriptor and repeats the transfer whenever it's ready,
+// until the transfer no longer would block. Unlike a poll task
+// followed by a continuation, it takes a single allocation and
+// survives spurious wakeups without another.
+template <typename Attempt>
+class fd_io_task
+	: public task_base<size_t>, noncopyable
+{
+public:
+	fd_io_task(int fd, short events, Attempt && attempt)
+		: m_fd(fd), m_events(events), m_waiter_id(new_poll_waiter_id()), m_attempt(std::move(attempt)), m_cancelled(false)
+	{
+	}
+
+	void cancel(cancel_level cl) throw()
+	{
+		if (!keep_polling(cl))
+			m_cancelled = true;
+	}
+
+	task_result<size_t> cancel_and_wait() throw()
+	{
+		return task_result<size_t>(te_cancelled);
+	}
+
+	void prepare_wait(task_wait_preparation_context & ctx)
+	{
+		if (m_cancelled)
+		{
+			ctx.set_finished();
+		}
+		else
+		{
+			struct pollfd pf = {};
+			pf.fd = m_fd;
+			pf.events = m_events;
+			ctx.get()->add_pollfd(pf, m_waiter_id);
+		}
+	}
+
+	task<size_t> finish_wait(task_wait_finalization_context & ctx) throw()
+	{
+		if (m_cancelled)
+			return async::fail<size_t>(te_cancelled);
+
+		// POLLHUP and POLLERR show up regardless of the requested events;
+		// the transfer reports them as the end of the stream or an error.
+		if (ctx.prep_ctx->get()->m_pollfds[ctx.selected_poll_item].revents & POLLNVAL)
+			return async::raise<size_t>(std::runtime_error("invalid descriptor"));
+
+		task<size_t> r = m_attempt();
+		if (r.empty())
+			return nulltask;
+		return r;
+	}
+
+private:
+	int m_fd;
+	short m_events;
+	uint64_t m_waiter_id;
+	Attempt m_attempt;
+	bool m_cancelled;
+};
+
+template <typename Attempt>
+task<size_t> wait_for_io(int fd, short events, Attempt && attempt)
+{
+	return protect([&] {
+		return task<size_t>(new fd_io_task<Attempt>(fd, events, std::move(attempt)));
+	});
+}
+
+bool is_pipe(int fd)
+{
+	struct stat st;
+	return fstat(fd, &st) == 0 && S_ISFIFO(st.st_mode);
+}
+
+int splice_once(int in_fd, int out_fd, size_t size)
+{
+	ssize_t r;
+	do
+	{
+		r = ::splice(in_fd, 0, out_fd, 0, size, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+	}
+	while (r < 0 && errno == EINTR);
+	return r;
+}
+
+// Moves one chunk; on EAGAIN, waits for whichever side isn't ready.
+task<size_t> splice_chunk(int in_fd, int out_fd, size_t size)
+{
+	ssize_t r = splice_once(in_fd, out_fd, size);
+	if (r > 0)
+		return async::value((size_t)r);
+	if (r == 0)
+		return async::fail<size_t>(te_eof);
+	if (errno != EAGAIN)
+		return io_error<size_t>("splice failed");
+
+	struct pollfd pf = { in_fd, POLLIN };
+	int wait_fd = in_fd;
+	short wait_events = POLLIN;
+	if (::poll(&pf, 1, 0) == 1)
+	{
+		wait_fd = out_fd;
+		wait_events = POLLOUT;
+	}
+
+	return make_linux_pollfd_task(wait_fd, wait_events, &keep_polling).then([in_fd, out_fd, size](short revents) -> task<size_t> {
+		if (revents & POLLNVAL)
+			return async::raise<size_t>(std::runtime_error("invalid descriptor"));
+		return splice_chunk(in_fd, out_fd, size);
+	});
+}
+
+} // namespace
+
+fd_stream::fd_stream()
+	: m_read_fd(-1), m_write_fd(-1), m_write_socket(false), m_write_shut(false)
+{
+}
+
+fd_stream::fd_stream(int fd)
+	: m_read_fd(-1), m_write_fd(-1), m_write_socket(false), m_write_shut(false)
+{
+	this->attach(fd);
+}
+
+fd_stream::fd_stream(int read_fd, int write_fd)
+	: m_read_fd(-1), m_write_fd(-1), m_write_socket(false), m_write_shut(false)
+{
+	this->attach(read_fd, write_fd);
+}
+
+fd_stream::~fd_stream()
+{
+	this->close();
+}
+
+void fd_stream::attach(int fd)
+{
+	this->attach(fd, fd);
+}
+
+void fd_stream::attach(int read_fd, int write_fd)
+{
+	assert(read_fd >= 0 && write_fd >= 0);
+
+	this->close();
+
+	// The stream owns the descriptors even if it can't use them.
+	m_read_fd = read_fd;
+	m_write_fd = write_fd;
+
+	set_nonblocking(read_fd);
+	if (write_fd != read_fd)
+		set_nonblocking(write_fd);
+	m_write_socket = is_socket(write_fd);
+}
+
+void fd_stream::close()
+{
+	if (m_write_fd != -1 && m_write_fd != m_read_fd)
+		::close(m_write_fd);
+	if (m_read_fd != -1)
+		::close(m_read_fd);
+
+	m_read_fd = -1;
+	m_write_fd = -1;
+	m_write_socket = false;
+	m_write_shut = false;
+}
+
+bool fd_stream::is_open() const
+{
+	return m_read_fd != -1;
+}
+
+int fd_stream::read_handle() const
+{
+	return m_read_fd;
+}
+
+int fd_stream::write_handle() const
+{
+	return m_write_shut? -1: m_write_fd;
+}
+
+void fd_stream::shutdown_write()
+{
+	if (m_write_shut || m_write_fd == -1)
+		return;
+
+	if (m_write_fd != m_read_fd)
+	{
+		::close(m_write_fd);
+		m_write_fd = -1;
+	}
+	else if (!m_write_socket || ::shutdown(m_write_fd, SHUT_WR) == -1)
+	{
+		throw std::runtime_error("cannot shut down the stream for writing");
+	}
+
+	m_write_shut = true;
+}
+
+task<size_t> fd_stream::read(uint8_t * buffer, size_t size)
+{
+	int fd = m_read_fd;
+	auto attempt = [fd, buffer, size]() -> task<size_t> {
+		ssize_t r;
+		do
+		{
+			r = ::read(fd, buffer, size);
+		}
+		while (r < 0 && errno == EINTR);
+		return io_result(r, size == 0, "read failed");
+	};
+
+	task<size_t> res = attempt();
+	if (!res.empty())
+		return res;
+	return wait_for_io(fd, POLLIN, std::move(attempt));
+}
+
+task<size_t> fd_stream::write(uint8_t const * buffer, size_t size)
+{
+	if (m_write_shut)
+		return async::fail<size_t>(te_eof);
+
+	int fd = m_write_fd;
+	bool socket = m_write_socket;
+	auto attempt = [fd, socket, buffer, size]() -> task<size_t> {
+		// Sockets are written to with MSG_NOSIGNAL, so that a closed peer
+		// is reported as EPIPE instead of raising SIGPIPE.
+		ssize_t r;
+		do
+		{
+			r = socket
+				? ::send(fd, buffer, size, MSG_NOSIGNAL)
+				: ::write(fd, buffer, size);
+		}
+		while (r < 0 && errno == EINTR);
+		return io_result(r, true, "write failed");
+	};
+
+	task<size_t> res = attempt();
+	if (!res.empty())
+		return res;
+	return wait_for_io(fd, POLLOUT, std::move(attempt));
+}
+
+task<size_t> fd_stream::readv(read_segment const * segments, size_t count)
+{
+	int fd = m_read_fd;
+	auto attempt = [fd, segments, count]() -> task<size_t> {
+		struct iovec iov[max_segments];
+		size_t iovcnt = (std::min)(count, (size_t)max_segments);
+		size_t total = 0;
+		for (size_t i = 0; i < iovcnt; ++i)
+		{
+			iov[i].iov_base = segments[i].data;
+			iov[i].iov_len = segments[i].size;
+			total += segments[i].size;
+		}
+
+		ssize_t r;
+		do
+		{
+			r = ::readv(fd, iov, iovcnt);
+		}
+		while (r < 0 && errno == EINTR);
+		return io_result(r, total == 0, "read failed");
+	};
+
+	task<size_t> res = attempt();
+	if (!res.empty())
+		return res;
+	return wait_for_io(fd, POLLIN, std::move(attempt));
+}
+
+task<size_t> fd_stream::writev(buffer_ref const * segments, size_t count)
+{
+	if (m_write_shut)
+		return async::fail<size_t>(te_eof);
+
+	int fd = m_write_fd;
+	bool socket = m_write_socket;
+	auto attempt = [fd, socket, segments, count]() -> task<size_t> {
+		struct iovec iov[max_segments];
+		size_t iovcnt = (std::min)(count, (size_t)max_segments);
+		for (size_t i = 0; i < iovcnt; ++i)
+		{
+			iov[i].iov_base = const_cast<uint8_t *>(segments[i].data());
+			iov[i].iov_len = segments[i].size();
+		}
+
+		ssize_t r;
+		do
+		{
+			if (socket)
+			{
+				struct msghdr msg = {};
+				msg.msg_iov = iov;
+				msg.msg_iovlen = iovcnt;
+				r = ::sendmsg(fd, &msg, MSG_NOSIGNAL);
+			}
+			else
+			{
+				r = ::writev(fd, iov, iovcnt);
+			}
+		}
+		while (r < 0 && errno == EINTR);
+		return io_result(r, true, "write failed");
+	};
+
+	task<size_t> res = attempt();
+	if (!res.empty())
+		return res;
+	return wait_for_io(fd, POLLOUT, std::move(attempt));
+}
+
+task<void> fd_stream::splice_from(stream & source, size_t buffer_size)
+{
+	fd_stream * src = dynamic_cast<fd_stream *>(&source);
+	if (!src || src->m_read_fd == -1 || m_write_fd == -1 || m_write_shut)
+		return task<void>();
+
+	int in_fd = src->m_read_fd;
+	int out_fd = m_write_fd;
+	if (!is_pipe(in_fd) && !is_pipe(out_fd))
+		return task<void>();
+
+	// The first chunk is tried right away; descriptors that can't
+	// be spliced are refused before any data are moved.
+	ssize_t r = splice_once(in_fd, out_fd, buffer_size);
+	if (r < 0 && errno == EINVAL)
+		return task<void>();
+
+	task<size_t> first;
+	if (r > 0)
+		first = async::value((size_t)r);
+	else if (r == 0)
+		first = async::fail<size_t>(te_eof);
+	else if (errno == EAGAIN)
+		first = async::value((size_t)0);
+	else
+		first = io_error<size_t>("splice failed");
+
+	return loop<size_t>(std::move(first), [in_fd, out_fd, buffer_size](size_t, cancel_level cl) -> task<size_t> {
+		if (cl >= cl_quit)
+			return nulltask;
+		return splice_chunk(in_fd, out_fd, buffer_size).abort_on(cl_quit);
+	});
+}
@@ -18,7 +18,7 @@ class linux_fdpoll_task
 {
 public:
 	linux_fdpoll_task(int fd, short events, Canceller && canceller)
-		: m_fd(fd), m_events(events), m_canceller(std::move(canceller))
+		: m_fd(fd), m_events(events), m_waiter_id(new_poll_waiter_id()), m_canceller(std::move(canceller))
 	{
 	}
 
@@ -47,7 +47,7 @@ public:
 		}
 		else
 		{
-			return task_result<short>(std::make_exception_ptr(task_cancelled()));
+			return task_result<short>(te_cancelled);
 		}
 	}
 
@@ -62,7 +62,7 @@ public:
 			struct pollfd pf = {};
 			pf.fd = m_fd;
 			pf.events = m_events;
-			ctx.get()->m_pollfds.push_back(pf);
+			ctx.get()->add_pollfd(pf, m_waiter_id);
 		}
 	}
 
@@ -71,12 +71,13 @@ public:
 		if (m_fd != -1)
 			return async::value(ctx.prep_ctx->get()->m_pollfds[ctx.selected_poll_item].revents);
 		else
-			return async::raise<short>(task_cancelled());
+			return async::fail<short>(te_cancelled);
 	}
 
 private:
 	int m_fd;
 	short m_events;
+	uint64_t m_waiter_id;
 	Canceller m_canceller;
 };
 
@@ -0,0 +1,242 @@
+#include "../socket_stream.hpp"
+#include "../when_all.hpp"
+#include "linux_fdpoll_task.hpp"
+#include "deadline_task.hpp"
+#include <algorithm>
+#include <stdexcept>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+using namespace yb;
+using namespace yb::detail;
+
+namespace {
+
+bool keep_polling(cancel_level cl)
+{
+	return cl < cl_abort;
+}
+
+void set_nodelay(int fd)
+{
+	int one = 1;
+	setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof one);
+}
+
+struct sockaddr_un make_unix_address(yb::string_ref const & path)
+{
+	struct sockaddr_un addr = {};
+	addr.sun_family = AF_UNIX;
+	if (path.size() >= sizeof addr.sun_path)
+		throw std::runtime_error("socket path too long");
+	std::copy(path.begin(), path.end(), addr.sun_path);
+	return addr;
+}
+
+struct sockaddr_in make_tcp_address(yb::string_ref const & address, uint16_t port)
+{
+	struct sockaddr_in addr = {};
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(port);
+	if (inet_pton(AF_INET, std::string(address).c_str(), &addr.sin_addr) != 1)
+		throw std::runtime_error("invalid IPv4 address");
+	return addr;
+}
+
+// A Unix socket listener with a full backlog turns a non-blocking
+// connect down with EAGAIN. The unconnected socket polls as writable
+// meanwhile, so the connect is retried after a short, growing delay.
+task<void> retry_unix_connect(int fd, struct sockaddr_un const & addr, uint64_t delay_us)
+{
+	return make_deadline_task(clock_now_us() + delay_us).then([fd, addr, delay_us]() -> task<void> {
+		if (::connect(fd, (struct sockaddr const *)&addr, sizeof addr) == 0)
+			return async::value();
+		if (errno != EAGAIN)
+			return async::raise<void>(std::runtime_error("cannot connect"));
+		return retry_unix_connect(fd, addr, (std::min)(delay_us * 2, (uint64_t)64000));
+	});
+}
+
+task<void> connect_socket(int fd, struct sockaddr const * addr, socklen_t addrlen)
+{
+	if (::connect(fd, addr, addrlen) == 0)
+		return async::value();
+	if (errno == EAGAIN && addr->sa_family == AF_UNIX)
+		return retry_unix_connect(fd, *(struct sockaddr_un const *)addr, 500);
+	if (errno != EINPROGRESS)
+		return async::raise<void>(std::runtime_error("cannot connect"));
+
+	return make_linux_pollfd_task(fd, POLLOUT, &keep_polling).then([fd](short) -> task<void> {
+		int err = 0;
+		socklen_t len = sizeof err;
+		if (getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &len) != 0 || err != 0)
+			return async::raise<void>(std::runtime_error("cannot connect"));
+		return async::value();
+	});
+}
+
+} // namespace
+
+socket_stream::socket_stream()
+{
+}
+
+socket_stream::socket_stream(int fd)
+	: fd_stream(fd)
+{
+}
+
+task<void> socket_stream::connect_unix(yb::string_ref const & path)
+{
+	return protect([&]() -> task<void> {
+		struct sockaddr_un addr = make_unix_address(path);
+
+		int fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+		if (fd == -1)
+			return async::raise<void>(std::runtime_error("cannot create a socket"));
+		this->attach(fd);
+
+		return connect_socket(fd, (struct sockaddr const *)&addr, sizeof addr);
+	});
+}
+
+task<void> socket_stream::connect_tcp(yb::string_ref const & address, uint16_t port)
+{
+	return protect([&]() -> task<void> {
+		struct sockaddr_in addr = make_tcp_address(address, port);
+
+		int fd = ::socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+		if (fd == -1)
+			return async::raise<void>(std::runtime_error("cannot create a socket"));
+		this->attach(fd);
+		set_nodelay(fd);
+
+		return connect_socket(fd, (struct sockaddr const *)&addr, sizeof addr);
+	});
+}
+
+socket_acceptor::socket_acceptor()
+	: m_fd(-1), m_tcp(false)
+{
+}
+
+socket_acceptor::~socket_acceptor()
+{
+	this->close();
+}
+
+void socket_acceptor::listen_unix(yb::string_ref const & path, int backlog)
+{
+	this->close();
+
+	struct sockaddr_un addr = make_unix_address(path);
+
+	// Only a socket left behind by an earlier server is removed.
+	struct stat st;
+	if (::stat(addr.sun_path, &st) == 0 && S_ISSOCK(st.st_mode))
+		::unlink(addr.sun_path);
+
+	int fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (fd == -1)
+		throw std::runtime_error("cannot create a socket");
+
+	if (::bind(fd, (struct sockaddr const *)&addr, sizeof addr) != 0 || ::listen(fd, backlog) != 0)
+	{
+		::close(fd);
+		throw std::runtime_error("cannot listen on the socket");
+	}
+
+	m_fd = fd;
+	m_tcp = false;
+	m_unix_path = addr.sun_path;
+}
+
+void socket_acceptor::listen_tcp(yb::string_ref const & address, uint16_t port, int backlog)
+{
+	this->close();
+
+	struct sockaddr_in addr = make_tcp_address(address, port);
+
+	int fd = ::socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (fd == -1)
+		throw std::runtime_error("cannot create a socket");
+
+	int one = 1;
+	setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof one);
+
+	if (::bind(fd, (struct sockaddr const *)&addr, sizeof addr) != 0 || ::listen(fd, backlog) != 0)
+	{
+		::close(fd);
+		throw std::runtime_error("cannot listen on the socket");
+	}
+
+	m_fd = fd;
+	m_tcp = true;
+}
+
+uint16_t socket_acceptor::local_port() const
+{
+	struct sockaddr_in addr = {};
+	socklen_t len = sizeof addr;
+	if (!m_tcp || getsockname(m_fd, (struct sockaddr *)&addr, &len) != 0)
+		return 0;
+	return ntohs(addr.sin_port);
+}
+
+void socket_acceptor::close()
+{
+	if (m_fd == -1)
+		return;
+
+	::close(m_fd);
+	m_fd = -1;
+
+	if (!m_unix_path.empty())
+	{
+		::unlink(m_unix_path.c_str());
+		m_unix_path.clear();
+	}
+}
+
+task<void> socket_acceptor::accept(socket_stream & s)
+{
+	for (;;)
+	{
+		int fd = ::accept4(m_fd, 0, 0, SOCK_NONBLOCK | SOCK_CLOEXEC);
+		if (fd != -1)
+		{
+			return protect([&]() -> task<void> {
+				s.attach(fd);
+				if (m_tcp)
+					set_nodelay(fd);
+				return async::value();
+			});
+		}
+
+		// A connection reset while still queued is simply skipped.
+		if (errno != EINTR && errno != ECONNABORTED)
+			break;
+	}
+
+	if (errno != EAGAIN && errno != EWOULDBLOCK)
+		return async::raise<void>(std::runtime_error("cannot accept a connection"));
+
+	return make_linux_pollfd_task(m_fd, POLLIN, &keep_polling).then([this, &s](short) {
+		return this->accept(s);
+	});
+}
+
+task<void> yb::bridge(stream & a, stream & b, size_t buffer_size)
+{
+	return when_any(copy(b, a, buffer_size), copy(a, b, buffer_size)).ignore_result().continue_with([](task_result<void> r) -> task<void> {
+		if (!r.has_exception() || (r.has_error() && r.error() == te_eof))
+			return async::value();
+		return async::fail<void>(r);
+	});
+}
@@ -0,0 +1,201 @@
+#include "../offload.hpp"
+#include "linux_fdpoll_task.hpp"
+#include "../../utils/detail/scoped_unix_fd.hpp"
+#include <deque>
+#include <vector>
+#include <stdexcept>
+#include <pthread.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/eventfd.h>
+using namespace yb;
+using namespace yb::detail;
+
+namespace {
+
+enum job_state
+{
+	js_pending,
+	js_running,
+	js_done,
+	js_cancelled
+};
+
+} // namespace
+
+struct offload_job_base::impl
+{
+	scoped_unix_fd done_event;
+	int state;
+
+	impl()
+		: state(js_pending)
+	{
+		done_event.reset(eventfd(0, 0));
+		if (done_event.empty())
+			throw std::runtime_error("cannot create eventfd");
+		if (fcntl(done_event.get(), F_SETFL, O_NONBLOCK) == -1)
+			throw std::runtime_error("cannot set O_NONBLOCK");
+	}
+};
+
+offload_job_base::offload_job_base()
+	: m_pimpl(new impl())
+{
+}
+
+offload_job_base::~offload_job_base()
+{
+}
+
+void offload_job_base::run() throw()
+{
+	if (!__sync_bool_compare_and_swap(&m_pimpl->state, js_pending, js_running))
+		return;
+
+	this->do_run();
+	__atomic_store_n(&m_pimpl->state, js_done, __ATOMIC_RELEASE);
+
+	uint64_t val = 1;
+	int r = write(m_pimpl->done_event.get(), &val, sizeof val);
+	assert(r != -1);
+	(void)r;
+}
+
+bool offload_job_base::cancel() throw()
+{
+	return __sync_bool_compare_and_swap(&m_pimpl->state, js_pending, js_cancelled);
+}
+
+task<void> offload_job_base::wait_done(std::shared_ptr<offload_job_base> const & job)
+{
+	return make_linux_pollfd_task(job->m_pimpl->done_event.get(), POLLIN, [job](cancel_level cl) {
+		return cl < cl_abort || !job->cancel();
+	}).ignore_result();
+}
+
+struct thread_pool::impl
+{
+	impl()
+		: stopped(false)
+	{
+		if (pthread_mutex_init(&mutex, 0) != 0)
+			throw std::runtime_error("failed to create a mutex");
+
+		if (pthread_cond_init(&cond, 0) != 0)
+		{
+			pthread_mutex_destroy(&mutex);
+			throw std::runtime_error("failed to create a condvar");
+		}
+	}
+
+	~impl()
+	{
+		pthread_cond_destroy(&cond);
+		pthread_mutex_destroy(&mutex);
+	}
+
+	void run()
+	{
+		for (;;)
+		{
+			std::shared_ptr<offload_job_base> job;
+
+			pthread_mutex_lock(&mutex);
+			while (!stopped && jobs.empty())
+				pthread_cond_wait(&cond, &mutex);
+
+			if (jobs.empty())
+			{
+				pthread_mutex_unlock(&mutex);
+				break;
+			}
+
+			job = std::move(jobs.front());
+			jobs.pop_front();
+			pthread_mutex_unlock(&mutex);
+
+			job->run();
+		}
+	}
+
+	static void * worker_thread(void * ctx)
+	{
+		impl * pimpl = (impl *)ctx;
+		pimpl->run();
+		return 0;
+	}
+
+	void stop()
+	{
+		pthread_mutex_lock(&mutex);
+		stopped = true;
+		pthread_cond_broadcast(&cond);
+		pthread_mutex_unlock(&mutex);
+
+		for (size_t i = 0; i < threads.size(); ++i)
+		{
+			void * retval;
+			pthread_join(threads[i], &retval);
+		}
+
+		threads.clear();
+	}
+
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	std::deque<std::shared_ptr<offload_job_base> > jobs;
+	bool stopped;
+
+	std::vector<pthread_t> threads;
+};
+
+thread_pool::thread_pool(size_t thread_count)
+	: m_pimpl(new impl())
+{
+	if (thread_count == 0)
+	{
+		long cpu_count = sysconf(_SC_NPROCESSORS_ONLN);
+		thread_count = cpu_count > 0? (size_t)cpu_count: 1;
+	}
+
+	m_pimpl->threads.reserve(thread_count);
+	for (size_t i = 0; i < thread_count; ++i)
+	{
+		pthread_t thread;
+		if (pthread_create(&thread, 0, &impl::worker_thread, m_pimpl.get()) != 0)
+		{
+			m_pimpl->stop();
+			throw std::runtime_error("failed to create a worker thread");
+		}
+
+		m_pimpl->threads.push_back(thread);
+	}
+}
+
+thread_pool::~thread_pool()
+{
+	m_pimpl->stop();
+}
+
+size_t thread_pool::thread_count() const
+{
+	return m_pimpl->threads.size();
+}
+
+void thread_pool::post(std::shared_ptr<offload_job_base> const & job)
+{
+	pthread_mutex_lock(&m_pimpl->mutex);
+	try
+	{
+		m_pimpl->jobs.push_back(job);
+	}
+	catch (...)
+	{
+		pthread_mutex_unlock(&m_pimpl->mutex);
+		throw;
+	}
+
+	pthread_cond_signal(&m_pimpl->cond);
+	pthread_mutex_unlock(&m_pimpl->mutex);
+}
@@ -1,25 +1,64 @@
 #include "../timer.hpp"
+#include "../clock.hpp"
+#include "deadline_task.hpp"
 #include "linux_fdpoll_task.hpp"
 #include "../../utils/detail/scoped_unix_fd.hpp"
 #include <stdexcept>
 #include <sys/timerfd.h>
 #include <fcntl.h>
+#include <errno.h>
 using namespace yb;
 using namespace yb::detail;
 
+namespace {
+
+struct timespec to_timespec(uint64_t us)
+{
+	struct timespec res;
+	res.tv_sec = us / 1000000;
+	res.tv_nsec = (us % 1000000) * 1000;
+	return res;
+}
+
+scoped_unix_fd create_timerfd()
+{
+	scoped_unix_fd fd(timerfd_create(CLOCK_MONOTONIC, 0));
+	if (fd.empty())
+		throw std::runtime_error("cannot create timerfd");
+	if (fcntl(fd.get(), F_SETFL, O_NONBLOCK) == -1)
+		throw std::runtime_error("cannot set O_NONBLOCK");
+	return fd;
+}
+
+} // namespace
+
 struct timer::impl
 {
 	scoped_unix_fd fd;
+
+	task<void> arm(int flags, uint64_t us)
+	{
+		struct itimerspec ts = {};
+		ts.it_value = to_timespec(us);
+		if (timerfd_settime(fd.get(), flags, &ts, 0) != 0)
+			return async::raise<void>(std::runtime_error("cannot set timerfd"));
+
+		return make_linux_pollfd_task(fd.get(), POLLIN, [this](cancel_level cl) {
+			if (cl < cl_abort)
+				return true;
+			struct itimerspec ts = {};
+			timerfd_settime(fd.get(), 0, &ts, 0);
+			return false;
+		}).then([](short revents) {
+			return revents & POLLIN? async::value(): async::raise<void>(std::runtime_error("timerfd poll error"));
+		});
+	}
 };
 
 timer::timer()
 	: m_pimpl(new impl())
 {
-	m_pimpl->fd.reset(timerfd_create(CLOCK_MONOTONIC, 0));
-	if (m_pimpl->fd.empty())
-		throw std::runtime_error("cannot create timerfd");
-	if (fcntl(m_pimpl->fd.get(), F_SETFL, O_NONBLOCK) == -1)
-		throw std::runtime_error("cannot set O_NONBLOCK");
+	m_pimpl->fd = create_timerfd();
 }
 
 timer::~timer()
@@ -29,20 +68,103 @@ timer::~timer()
 task<void> timer::wait_ms(int milliseconds)
 {
 	assert(milliseconds > 0);
+	return this->wait_us(milliseconds * 1000ull);
+}
+
+task<void> timer::wait_us(uint64_t microseconds)
+{
+	if (virtual_clock * clock = virtual_clock::current())
+		return make_deadline_task(clock->now_us() + microseconds);
+
+	// A zero it_value would disarm the timer instead.
+	if (microseconds == 0)
+		return async::value();
+
+	return m_pimpl->arm(0, microseconds);
+}
+
+task<void> timer::wait_until(uint64_t deadline_us)
+{
+	if (virtual_clock::current())
+		return make_deadline_task(deadline_us);
+
+	if (deadline_us <= clock_now_us())
+		return async::value();
 
-	struct itimerspec ts = {};
-	ts.it_value.tv_sec = milliseconds / 1000;
-	ts.it_value.tv_nsec = (milliseconds % 1000) * 1000000;
+	// `clock_now_us` measures the system time on CLOCK_MONOTONIC.
+	return m_pimpl->arm(TFD_TIMER_ABSTIME, deadline_us);
+}
+
+struct interval::impl
+{
+	scoped_unix_fd fd;
+	uint64_t period_us;
+
+	// Only used on a virtual clock, where there is no timerfd.
+	uint64_t next_tick_us;
+
+	task<uint64_t> wait_virtual()
+	{
+		return make_deadline_task(next_tick_us).then([this]() -> uint64_t {
+			uint64_t ticks = (clock_now_us() - next_tick_us) / period_us + 1;
+			next_tick_us += ticks * period_us;
+			return ticks;
+		});
+	}
+
+	task<uint64_t> wait_timerfd()
+	{
+		return make_linux_pollfd_task(fd.get(), POLLIN, [](cancel_level cl) {
+			// Cancelling the wait leaves the schedule running.
+			return cl < cl_abort;
+		}).then([this](short revents) -> task<uint64_t> {
+			if ((revents & POLLIN) == 0)
+				return async::raise<uint64_t>(std::runtime_error("timerfd poll error"));
+
+			// The expiration count includes the ticks that were missed.
+			uint64_t ticks;
+			if (read(fd.get(), &ticks, sizeof ticks) == sizeof ticks)
+				return async::value(ticks);
+			if (errno == EAGAIN)
+				return this->wait_timerfd();
+			return async::raise<uint64_t>(std::runtime_error("cannot read timerfd"));
+		});
+	}
+};
+
+interval::interval(uint64_t period_us)
+	: m_pimpl(new impl())
+{
+	assert(period_us > 0);
+	m_pimpl->period_us = period_us;
+
+	if (virtual_clock * clock = virtual_clock::current())
+	{
+		m_pimpl->next_tick_us = clock->now_us() + period_us;
+		return;
+	}
+
+	m_pimpl->fd = create_timerfd();
+
+	struct itimerspec ts;
+	ts.it_value = to_timespec(period_us);
+	ts.it_interval = ts.it_value;
 	if (timerfd_settime(m_pimpl->fd.get(), 0, &ts, 0) != 0)
-		return async::raise<void>(std::runtime_error("cannot set timerfd"));
+		throw std::runtime_error("cannot set timerfd");
+}
 
-	return make_linux_pollfd_task(m_pimpl->fd.get(), POLLIN, [this](cancel_level cl) {
-		if (cl < cl_abort)
-			return true;
-		struct itimerspec ts = {};
-		timerfd_settime(m_pimpl->fd.get(), 0, &ts, 0);
-		return false;
-	}).then([](short revents) {
-		return revents & POLLIN? async::value(): async::raise<void>(std::runtime_error("timerfd poll error"));
-	});
+interval::~interval()
+{
+}
+
+uint64_t interval::period_us() const
+{
+	return m_pimpl->period_us;
+}
+
+task<uint64_t> interval::wait()
+{
+	if (m_pimpl->fd.empty())
+		return m_pimpl->wait_virtual();
+	return m_pimpl->wait_timerfd();
 }
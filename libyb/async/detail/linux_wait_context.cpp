@@ -2,7 +2,8 @@
 using namespace yb;
 
 task_wait_preparation_context::task_wait_preparation_context()
-	: m_pimpl(new task_wait_preparation_context_impl())
+	: m_pimpl(new task_wait_preparation_context_impl()), m_deadline_us(no_deadline),
+	m_budget(default_budget), m_budget_left(default_budget), m_probing(false)
 {
 }
 
@@ -13,7 +14,11 @@ task_wait_preparation_context::~task_wait_preparation_context()
 void task_wait_preparation_context::clear()
 {
 	m_pimpl->m_pollfds.clear();
+	m_pimpl->m_waiter_ids.clear();
 	m_pimpl->m_finished_tasks = 0;
+	m_routes.clear();
+	m_deadline_us = no_deadline;
+	m_budget_left = m_budget;
 }
 
 task_wait_preparation_context_impl * task_wait_preparation_context::get() const
@@ -30,6 +35,21 @@ task_wait_checkpoint task_wait_preparation_context::checkpoint() const
 {
 	task_wait_checkpoint res;
 	res.poll_item_count = m_pimpl->m_pollfds.size();
+	res.route_count = m_routes.size();
 	res.finished_task_count = m_pimpl->m_finished_tasks;
 	return res;
 }
+
+void task_wait_preparation_context::rollback(task_wait_checkpoint const & chkp) throw()
+{
+	m_pimpl->m_pollfds.resize(chkp.poll_item_count);
+	m_pimpl->m_waiter_ids.resize(chkp.poll_item_count);
+	m_pimpl->m_finished_tasks = chkp.finished_task_count;
+	m_routes.truncate(chkp.route_count, chkp.poll_item_count);
+}
+
+uint64_t yb::detail::new_poll_waiter_id()
+{
+	static uint64_t next_id = 0;
+	return __atomic_add_fetch(&next_id, 1, __ATOMIC_RELAXED);
+}
@@ -3,6 +3,7 @@
 
 #include "wait_context.hpp"
 #include <vector>
+#include <stdint.h>
 #include <sys/poll.h>
 
 namespace yb {
@@ -14,9 +15,36 @@ struct task_wait_poll_item
 struct task_wait_preparation_context_impl
 {
 	std::vector<struct pollfd> m_pollfds;
+
+	// Tells apart successive waiters on a descriptor number, which may
+	// have been closed and reused in between; one per poll item.
+	std::vector<uint64_t> m_waiter_ids;
+
 	size_t m_finished_tasks;
+
+	void add_pollfd(struct pollfd const & pf, uint64_t waiter_id)
+	{
+		m_waiter_ids.push_back(waiter_id);
+		try
+		{
+			m_pollfds.push_back(pf);
+		}
+		catch (...)
+		{
+			m_waiter_ids.pop_back();
+			throw;
+		}
+	}
 };
 
+namespace detail {
+
+// Returns an id no other waiter got before; waiters that keep
+// polling the same descriptor should keep their id.
+uint64_t new_poll_waiter_id();
+
+} // namespace detail
+
 } // namespace yb
 
 #endif // LIBYB_ASYNC_DETAIL_WIN32_WAIT_CONTEXT_HPP
@@ -125,7 +125,7 @@ task_result<void> loop_task<S, F, T>::cancel_and_wait() throw()
 	{
 		task_result<S> r = m_task.cancel_and_wait();
 		if (r.has_exception())
-			return r.exception();
+			return failed_result<void>(r);
 		m_task = invoke_loop_body(m_f, std::move(r), *this, cl_kill);
 	}
 
@@ -135,21 +135,33 @@ task_result<void> loop_task<S, F, T>::cancel_and_wait() throw()
 template <typename S, typename F, typename T>
 void loop_task<S, F, T>::prepare_wait(task_wait_preparation_context & ctx)
 {
-	m_task.prepare_wait(ctx);
+	// A loop that ran out of budget is ready to go on.
+	if (m_task.has_result())
+		ctx.set_finished();
+	else
+		m_task.prepare_wait(ctx);
 }
 
 template <typename S, typename F, typename T>
 task<void> loop_task<S, F, T>::finish_wait(task_wait_finalization_context & ctx) throw()
 {
-	m_task.finish_wait(ctx);
-	while (m_task.has_result())
+	if (m_task.has_task())
+		m_task.finish_wait(ctx);
+
+	// The first iteration is always taken, so that a loop
+	// makes progress even when others have used up the budget.
+	for (bool first = true; m_task.has_result(); first = false)
 	{
+		if (!first && !ctx.prep_ctx->consume_budget())
+			break;
+
 		task_result<S> r = m_task.get_result();
 		if (r.has_exception())
-			return async::raise<void>(r.exception());
+			return async::fail<void>(r);
 		m_task = invoke_loop_body(m_f, std::move(r), *this, m_cancel_level);
 		if (m_task.empty())
 			return async::value();
+		m_task.normalize(*ctx.prep_ctx);
 	}
 
 	return nulltask;
@@ -162,7 +174,7 @@ task<void> loop(task<S> && t, loop_state<T> & state, F && f)
 	{
 		task_result<S> r = t.get_result();
 		if (r.has_exception())
-			return async::raise<void>(r.exception());
+			return async::fail<void>(r);
 		t = detail::invoke_loop_body(f, std::move(r), state, cl_none);
 		if (t.empty())
 			return async::value();
@@ -178,7 +190,7 @@ task<void> loop(task<S> && t, loop_state<T> & state, F && f)
 		{
 			task_result<S> r = t.cancel_and_wait();
 			if (r.has_exception())
-				return async::raise<void>(r.exception());
+				return async::fail<void>(r);
 			t = detail::invoke_loop_body(f, std::move(r), state, cl_none);
 		}
 
@@ -0,0 +1,94 @@
+#ifndef LIBYB_ASYNC_DETAIL_OFFLOAD_JOB_HPP
+#define LIBYB_ASYNC_DETAIL_OFFLOAD_JOB_HPP
+
+#include "../task.hpp"
+#include "../../utils/noncopyable.hpp"
+#include <memory>
+#include <type_traits>
+
+namespace yb {
+namespace detail {
+
+class offload_job_base
+	: noncopyable
+{
+public:
+	offload_job_base();
+	virtual ~offload_job_base();
+
+	// Called by a pool worker. Runs the job unless it was cancelled
+	// before it could start and signals the waiting runner.
+	void run() throw();
+
+	// Prevents a job that didn't start yet from ever running.
+	// Returns false if the job is already running or has finished.
+	bool cancel() throw();
+
+	// Completes on the waiting runner once the job has finished.
+	// The task fails with `te_cancelled` if the job was cancelled
+	// before it started.
+	static task<void> wait_done(std::shared_ptr<offload_job_base> const & job);
+
+protected:
+	virtual void do_run() throw() = 0;
+
+private:
+	struct impl;
+	std::unique_ptr<impl> m_pimpl;
+};
+
+template <typename R, typename F>
+class offload_job
+	: public offload_job_base
+{
+public:
+	explicit offload_job(F && f)
+		: m_f(std::move(f))
+	{
+	}
+
+	task<R> get_result()
+	{
+		assert(m_result.has_result());
+		return std::move(m_result);
+	}
+
+protected:
+	void do_run() throw()
+	{
+		try
+		{
+			this->invoke(std::is_void<R>());
+		}
+		catch (...)
+		{
+			m_result = async::raise<R>();
+		}
+	}
+
+private:
+	void invoke(std::false_type)
+	{
+		m_result = async::value(m_f());
+	}
+
+	void invoke(std::true_type)
+	{
+		m_f();
+		m_result = async::value();
+	}
+
+	F m_f;
+	task<R> m_result;
+};
+
+template <typename F>
+struct offload_result
+{
+	typedef typename std::remove_const<typename std::remove_reference<decltype((*(F*)0)())>::type>::type type;
+};
+
+} // namespace detail
+} // namespace yb
+
+#endif // LIBYB_ASYNC_DETAIL_OFFLOAD_JOB_HPP
@@ -5,69 +5,144 @@ using namespace yb;
 using namespace yb::detail;
 
 parallel_composition_task::parallel_composition_task(task<void> && t, task<void> && u)
+	: m_active_count(2), m_finishing(false)
 {
 	m_tasks.resize(2);
 	m_tasks.front().t = std::move(t);
 	m_tasks.back().t = std::move(u);
 }
 
+void parallel_composition_task::append(task<void> && t)
+{
+	assert(t.has_task());
+	std::vector<parallel_task> & tasks = m_finishing? m_appended: m_tasks;
+	tasks.emplace_back();
+	tasks.back().t = std::move(t);
+	++m_active_count;
+}
+
 void parallel_composition_task::cancel(cancel_level cl) throw()
 {
-	for (std::list<parallel_task>::iterator it = m_tasks.begin(); it != m_tasks.end(); ++it)
-		it->t.cancel(cl);
+	for (size_t i = 0; i < m_tasks.size(); ++i)
+		m_tasks[i].t.cancel(cl);
+	for (size_t i = 0; i < m_appended.size(); ++i)
+		m_appended[i].t.cancel(cl);
 }
 
 task_result<void> parallel_composition_task::cancel_and_wait() throw()
 {
-	for (std::list<parallel_task>::iterator it = m_tasks.begin(); it != m_tasks.end(); ++it)
-		it->t.cancel_and_wait(); // XXX: handle exc results
+	for (size_t i = 0; i < m_tasks.size(); ++i)
+	{
+		if (m_tasks[i].t.has_task())
+			m_tasks[i].t.cancel_and_wait(); // XXX: handle exc results
+	}
+
+	for (size_t i = 0; i < m_appended.size(); ++i)
+		m_appended[i].t.cancel_and_wait();
+
 	m_tasks.clear();
+	m_appended.clear();
+	m_active_count = 0;
 	return task_result<void>();
 }
 
 void parallel_composition_task::prepare_wait(task_wait_preparation_context & ctx)
 {
-	for (std::list<parallel_task>::iterator it = m_tasks.begin(); it != m_tasks.end(); ++it)
+	if (m_active_count != m_tasks.size())
+	{
+		size_t last = 0;
+		for (size_t i = 0; i < m_tasks.size(); ++i)
+		{
+			if (!m_tasks[i].t.has_task())
+				continue;
+			if (i != last)
+				m_tasks[last] = std::move(m_tasks[i]);
+			++last;
+		}
+		m_tasks.resize(last);
+	}
+
+	if (!m_appended.empty())
+	{
+		m_tasks.reserve(m_tasks.size() + m_appended.size());
+		for (size_t i = 0; i < m_appended.size(); ++i)
+			m_tasks.push_back(std::move(m_appended[i]));
+		m_appended.clear();
+	}
+
+	for (size_t i = 0; i < m_tasks.size(); ++i)
+	{
+		task_wait_memento_builder mb(ctx, i);
+		m_tasks[i].t.prepare_wait(ctx);
+		m_tasks[i].m = mb.finish();
+	}
+}
+
+void parallel_composition_task::finish_child(task_wait_finalization_context & ctx, size_t slot) throw()
+{
+	task<void> & t = m_tasks[slot].t;
+	t.finish_wait(ctx); // XXX: handle exc results
+	if (t.has_result())
 	{
-		task_wait_memento_builder mb(ctx);
-		it->t.prepare_wait(ctx);
-		it->m = mb.finish();
+		t.clear();
+		--m_active_count;
 	}
 }
 
 task<void> parallel_composition_task::finish_wait(task_wait_finalization_context & ctx) throw()
 {
-	for (std::list<parallel_task>::iterator it = m_tasks.begin(); it != m_tasks.end(); )
+	task_wait_route_step step(ctx);
+	size_t slot = step.slot();
+
+	m_finishing = true;
+
+	if (slot < m_tasks.size() && m_tasks[slot].t.has_task() && ctx.contains(m_tasks[slot].m))
+	{
+		this->finish_child(ctx, slot);
+	}
+	else
 	{
-		if (ctx.contains(it->m))
+		for (size_t i = 0; i < m_tasks.size(); ++i)
 		{
-			it->t.finish_wait(ctx); // XXX: handle exc results
-			if (it->t.has_result())
-			{
-				it = m_tasks.erase(it);
-				continue;
-			}
+			if (m_tasks[i].t.has_task() && ctx.contains(m_tasks[i].m))
+				this->finish_child(ctx, i);
 		}
-
-		++it;
 	}
 
-	switch (m_tasks.size())
+	m_finishing = false;
+
+	switch (m_active_count)
 	{
 	case 0:
 		return async::value();
 	case 1:
-		return std::move(m_tasks.front().t);
+		for (size_t i = 0; i < m_tasks.size(); ++i)
+		{
+			if (m_tasks[i].t.has_task())
+				return std::move(m_tasks[i].t);
+		}
+		if (!m_appended.empty())
+			return std::move(m_appended.front().t);
+		assert(false);
+		return nulltask;
 	default:
 		return nulltask;
 	}
 }
 
 parallel_composition_task::parallel_task::parallel_task()
+	: m()
 {
 }
 
 parallel_composition_task::parallel_task::parallel_task(parallel_task && o)
-	: t(std::move(o.t))
+	: t(std::move(o.t)), m(o.m)
+{
+}
+
+parallel_composition_task::parallel_task & parallel_composition_task::parallel_task::operator=(parallel_task && o)
 {
+	t = std::move(o.t);
+	m = o.m;
+	return *this;
 }
@@ -3,7 +3,7 @@
 
 #include "../task_base.hpp"
 #include "wait_context.hpp"
-#include <list>
+#include <vector>
 
 namespace yb {
 namespace detail {
@@ -14,6 +14,11 @@ class parallel_composition_task
 public:
 	parallel_composition_task(task<void> && t, task<void> && u);
 
+	// Adds another pending task; `t` is left untouched if this throws.
+	// Tasks appended while the node is finishing, e.g. by a continuation
+	// that posts to its own runner, join it in the next `prepare_wait`.
+	void append(task<void> && t);
+
 	void cancel(cancel_level cl) throw();
 	task_result<void> cancel_and_wait() throw();
 	void prepare_wait(task_wait_preparation_context & ctx);
@@ -27,9 +32,20 @@ private:
 
 		parallel_task();
 		parallel_task(parallel_task && o);
+		parallel_task & operator=(parallel_task && o);
 	};
 
-	std::list<parallel_task> m_tasks;
+	void finish_child(task_wait_finalization_context & ctx, size_t slot) throw();
+
+	// Finished tasks leave an empty slot behind until the next
+	// `prepare_wait`, so that slot indices stay valid during finalization.
+	std::vector<parallel_task> m_tasks;
+	size_t m_active_count;
+
+	// `m_tasks` must not reallocate while a child is being finished,
+	// so tasks appended meanwhile wait here for the next `prepare_wait`.
+	bool m_finishing;
+	std::vector<parallel_task> m_appended;
 };
 
 } // namespace detail
@@ -37,7 +37,7 @@ public:
 		if (m_buffer)
 			return task_result<T>(m_buffer->front());
 		else
-			return task_result<T>(std::make_exception_ptr(task_cancelled()));
+			return task_result<T>(te_cancelled);
 	}
 
 	void prepare_wait(task_wait_preparation_context & ctx)
@@ -51,7 +51,7 @@ public:
 		if (m_buffer)
 			return async::result(m_buffer->front());
 		else
-			return async::raise<T>(task_cancelled());
+			return async::fail<T>(te_cancelled);
 	}
 
 private:
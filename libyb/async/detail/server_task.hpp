@@ -0,0 +1,139 @@
+#ifndef LIBYB_ASYNC_DETAIL_SERVER_TASK_HPP
+#define LIBYB_ASYNC_DETAIL_SERVER_TASK_HPP
+
+#include "../task.hpp"
+#include "wait_context.hpp"
+#include <memory>
+
+namespace yb {
+namespace detail {
+
+// Runs an accept loop next to the tasks serving the accepted clients.
+// The clients are kept in a single parallel composition, which grows
+// as connections come in and is dropped whenever it drains.
+template <typename F>
+class server_task
+	: public task_base<void>
+{
+public:
+	server_task(socket_acceptor & acceptor, F && on_client)
+		: m_acceptor(acceptor), m_on_client(std::move(on_client))
+	{
+		this->start_accept();
+		this->start_clients();
+	}
+
+	void cancel(cancel_level cl) throw()
+	{
+		m_accept.cancel(cl_abort);
+		m_clients.cancel(cl);
+	}
+
+	task_result<void> cancel_and_wait() throw()
+	{
+		if (m_accept.has_task())
+			m_accept = async::result(m_accept.cancel_and_wait());
+		if (m_clients.has_task())
+			m_clients.cancel_and_wait();
+		return m_failure;
+	}
+
+	void prepare_wait(task_wait_preparation_context & ctx)
+	{
+		if (!m_accept.has_task() && !m_clients.has_task())
+			ctx.set_finished();
+
+		if (m_accept.has_task())
+		{
+			task_wait_memento_builder mb(ctx);
+			m_accept.prepare_wait(ctx);
+			m_accept_memento = mb.finish();
+		}
+
+		if (m_clients.has_task())
+		{
+			task_wait_memento_builder mb(ctx);
+			m_clients.prepare_wait(ctx);
+			m_clients_memento = mb.finish();
+		}
+	}
+
+	task<void> finish_wait(task_wait_finalization_context & ctx) throw()
+	{
+		if (m_accept.has_task() && ctx.contains(m_accept_memento))
+			m_accept.finish_wait(ctx);
+		if (m_clients.has_task() && ctx.contains(m_clients_memento))
+			m_clients.finish_wait(ctx);
+
+		this->start_clients();
+
+		if (m_clients.has_result())
+			m_clients = task<void>();
+
+		if (!m_accept.has_task() && !m_clients.has_task())
+			return async::result(m_failure);
+		return nulltask;
+	}
+
+private:
+	void start_accept() throw()
+	{
+		try
+		{
+			m_connection = std::make_shared<socket_stream>();
+			m_accept = m_acceptor.accept(*m_connection);
+		}
+		catch (...)
+		{
+			m_accept = async::raise<void>();
+		}
+	}
+
+	// Hands every accepted connection to a new client task and goes
+	// on accepting. A failed accept stops the server; a cancelled one
+	// just stops accepting.
+	void start_clients() throw()
+	{
+		while (m_accept.has_result())
+		{
+			task_result<void> r = m_accept.get_result();
+			m_accept = task<void>();
+
+			if (r.has_exception())
+			{
+				if (!r.has_error() || r.error() != te_cancelled)
+				{
+					m_failure = std::move(r);
+					m_clients.cancel(cl_abort);
+				}
+				break;
+			}
+
+			std::shared_ptr<socket_stream> conn = std::move(m_connection);
+			m_clients |= protect([this, conn] {
+				return m_on_client(conn);
+			}).ignore_result().continue_with([](task_result<void> const &) {
+				return async::value();
+			});
+
+			this->start_accept();
+		}
+	}
+
+	socket_acceptor & m_acceptor;
+	F m_on_client;
+
+	std::shared_ptr<socket_stream> m_connection;
+	task<void> m_accept;
+	task_wait_memento m_accept_memento;
+
+	task<void> m_clients;
+	task_wait_memento m_clients_memento;
+
+	task_result<void> m_failure;
+};
+
+} // namespace detail
+} // namespace yb
+
+#endif // LIBYB_ASYNC_DETAIL_SERVER_TASK_HPP
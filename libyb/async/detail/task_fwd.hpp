@@ -7,6 +7,7 @@
 #include "../cancellation_token.hpp"
 #include <memory> // unique_ptr
 #include <exception> // exception_ptr, exception
+#include <typeinfo> // type_info
 
 #include <type_traits> // conditional
 
@@ -98,7 +99,11 @@ public:
 
 	void clear() throw();
 
+	// Runs the task for as long as it completes without waiting.
+	// The overload taking a context borrows it for the probe
+	// and leaves it the way it was.
 	void normalize() throw();
+	void normalize(task_wait_preparation_context & prep_ctx) throw();
 
 	bool empty() const;
 	bool has_task() const;
@@ -115,6 +120,10 @@ public:
 
 	std::unique_ptr<task_base<result_type> > release();
 
+	// Returns the dynamic type of the pending task, `task_result<R>`
+	// if the task has completed or `void` if the task is empty.
+	std::type_info const & target_type() const;
+
 	template <typename F>
 	auto continue_with(F f) -> decltype(f(*(task_result<R>*)0));
 
@@ -137,6 +146,8 @@ public:
 private:
 	typedef task_base<R> * task_base_ptr;
 
+	void replace_task(task<R> && n) throw();
+
 	enum kind_t { k_empty, k_result, k_task };
 
 	task_base_ptr & as_task() { return reinterpret_cast<task_base_ptr &>(m_storage); }
@@ -219,6 +230,24 @@ task<R> raise()
 	return task<R>(std::current_exception());
 }
 
+// Fails with an error code; no exception object is created.
+template <typename R>
+task<R> fail(task_error e)
+{
+	return task<R>(task_result<R>(e));
+}
+
+// Fails with the error code or the exception of the failed result `r`.
+template <typename R, typename S>
+task<R> fail(task_result<S> const & r)
+{
+	return task<R>(failed_result<R>(r));
+}
+
+// Completes in a later runner round, after the runner has polled
+// for I/O; long synchronous loops can use it to let others run.
+task<void> yield();
+
 } // namespace async
 
 } // namespace yb
@@ -12,6 +12,24 @@ yb::task<void> yb::operator|(task<void> && lhs, task<void> && rhs)
 
 	try
 	{
+		// Keep `a | b | c` flat, so that the children of one node
+		// are addressed by their slot rather than by nesting.
+		if (lhs.target_type() == typeid(detail::parallel_composition_task))
+		{
+			std::unique_ptr<task_base<void> > p = lhs.release();
+			try
+			{
+				static_cast<detail::parallel_composition_task *>(p.get())->append(std::move(rhs));
+			}
+			catch (...)
+			{
+				lhs = task<void>(std::move(p));
+				throw;
+			}
+
+			return task<void>(std::move(p));
+		}
+
 		return yb::task<void>(new detail::parallel_composition_task(std::move(lhs), std::move(rhs)));
 	}
 	catch (...)
@@ -5,6 +5,8 @@
 #include "loop_task.hpp"
 #include "cancel_level_upgrade_task.hpp"
 #include "cancellation_token_task.hpp"
+#include "yield_task.hpp"
+#include "wait_context.hpp"
 #include <type_traits>
 
 namespace yb {
@@ -107,12 +109,16 @@ void task<R>::clear() throw()
 template <typename R>
 void task<R>::normalize() throw()
 {
-	while (m_kind == k_task)
+	if (m_kind != k_task)
+		return;
+
+	try
+	{
+		task_wait_preparation_context prep_ctx;
+		this->normalize(prep_ctx);
+	}
+	catch (...)
 	{
-		task<R> n = this->as_task()->run();
-		if (n.empty())
-			break;
-		*this = n;
 	}
 }
 
@@ -181,17 +187,66 @@ template <typename R>
 void task<R>::finish_wait(task_wait_finalization_context & ctx)
 {
 	assert(m_kind == k_task);
-	task_base_ptr p = this->as_task();
-	task<R> n = p->finish_wait(ctx);
+	task<R> n = this->as_task()->finish_wait(ctx);
 
 	if (!n.empty())
 	{
-		assert(m_kind == k_task);
-		delete p;
-		this->as_task().~task_base_ptr();
-		m_kind = k_empty;
+		this->replace_task(std::move(n));
+		this->normalize(*ctx.prep_ctx);
+	}
+}
+
+template <typename R>
+void task<R>::replace_task(task<R> && n) throw()
+{
+	assert(m_kind == k_task);
+	delete this->as_task();
+	this->as_task().~task_base_ptr();
+	m_kind = k_empty;
+
+	*this = std::move(n);
+}
+
+// A continuation that is ready as soon as it is prepared is finished
+// on the spot rather than in the runner's next round. The loop keeps
+// the stack depth constant however long the chain of ready
+// continuations is; whatever the probe adds to `prep_ctx` is dropped.
+// Tasks can tell the probe from the runner's preparation by
+// `task_wait_preparation_context::probing`.
+template <typename R>
+void task<R>::normalize(task_wait_preparation_context & prep_ctx) throw()
+{
+	while (m_kind == k_task)
+	{
+		task_wait_checkpoint chkp = prep_ctx.checkpoint();
+		task<R> n;
 
-		*this = std::move(n);
+		bool probing = prep_ctx.probing();
+		try
+		{
+			prep_ctx.set_probing(true);
+			this->as_task()->prepare_wait(prep_ctx);
+			prep_ctx.set_probing(probing);
+
+			task_wait_checkpoint ready = prep_ctx.checkpoint();
+			if (ready.finished_task_count != chkp.finished_task_count)
+			{
+				task_wait_finalization_context ctx;
+				ctx.prep_ctx = &prep_ctx;
+				ctx.finished_tasks = ready.finished_task_count - chkp.finished_task_count;
+				ctx.selected_poll_item = 0;
+				n = this->as_task()->finish_wait(ctx);
+			}
+		}
+		catch (...)
+		{
+			prep_ctx.set_probing(probing);
+		}
+
+		prep_ctx.rollback(chkp);
+		if (n.empty())
+			break;
+		this->replace_task(std::move(n));
 	}
 }
 
@@ -225,6 +280,30 @@ task_result<R> task<R>::cancel_and_wait()
 	return std::move(this->as_result());
 }
 
+template <typename R>
+std::unique_ptr<task_base<R> > task<R>::release()
+{
+	assert(m_kind == k_task);
+	std::unique_ptr<task_base<R> > res(this->as_task());
+	this->as_task().~task_base_ptr();
+	m_kind = k_empty;
+	return res;
+}
+
+template <typename R>
+std::type_info const & task<R>::target_type() const
+{
+	switch (m_kind)
+	{
+	case k_task:
+		return typeid(*this->as_task());
+	case k_result:
+		return typeid(task_result<R>);
+	default:
+		return typeid(void);
+	}
+}
+
 template <typename R>
 template <typename F>
 auto task<R>::continue_with(F f) -> decltype(f(*(task_result<R>*)0))
@@ -252,7 +331,7 @@ task<R> then_impl(task<S> && t, F const & f, std::true_type, X)
 {
 	return t.continue_with([f](task_result<S> r) -> task<R> {
 		if (r.has_exception())
-			return async::raise<R>(r.exception());
+			return async::fail<R>(r);
 		return f(r.get());
 	});
 }
@@ -262,7 +341,7 @@ task<R> then_impl(task<S> && t, F const & f, std::false_type, std::true_type)
 {
 	return t.continue_with([f](task_result<S> r) -> task<R> {
 		if (r.has_exception())
-			return async::raise<R>(r.exception());
+			return async::fail<R>(r);
 		f(r.get());
 		return async::value();
 	});
@@ -273,7 +352,7 @@ task<R> then_impl(task<S> && t, F const & f, std::false_type, std::false_type)
 {
 	return t.continue_with([f](task_result<S> r) -> task<R> {
 		if (r.has_exception())
-			return async::raise<R>(r.exception());
+			return async::fail<R>(r);
 		return async::value(f(r.get()));
 	});
 }
@@ -283,7 +362,7 @@ task<R> then_impl(task<void> && t, F const & f, std::true_type, X)
 {
 	return t.continue_with([f](task_result<void> r) -> task<R> {
 		if (r.has_exception())
-			return async::raise<R>(r.exception());
+			return async::fail<R>(r);
 		return f();
 	});
 }
@@ -293,7 +372,7 @@ task<R> then_impl(task<void> && t, F const & f, std::false_type, std::true_type)
 {
 	return t.continue_with([f](task_result<void> r) -> task<R> {
 		if (r.has_exception())
-			return async::raise<R>(r.exception());
+			return async::fail<R>(r);
 		f();
 		return async::value();
 	});
@@ -304,7 +383,7 @@ task<R> then_impl(task<void> && t, F const & f, std::false_type, std::false_type
 {
 	return t.continue_with([f](task_result<void> r) -> task<R> {
 		if (r.has_exception())
-			return async::raise<R>(r.exception());
+			return async::fail<R>(r);
 		return async::value(f());
 	});
 }
@@ -334,7 +413,7 @@ task<R> task<R>::follow_with(F f)
 {
 	return this->continue_with([f](task_result<R> r) -> task<R> {
 		if (r.has_exception())
-			return async::raise<R>(r.exception());
+			return async::fail<R>(r);
 		R v(r.get());
 		f(v);
 		return async::value(std::move(v));
@@ -347,7 +426,7 @@ task<void> task<void>::follow_with(F f)
 {
 	return this->continue_with([f](task_result<void> r) -> task<void> {
 		if (r.has_exception())
-			return async::raise<void>(r.exception());
+			return async::fail<void>(r);
 		f();
 		return async::value();
 	});
@@ -2,7 +2,8 @@
 using namespace yb;
 
 task_wait_preparation_context::task_wait_preparation_context()
-	: m_pimpl(new task_wait_preparation_context_impl())
+	: m_pimpl(new task_wait_preparation_context_impl()), m_deadline_us(no_deadline),
+	m_budget(default_budget), m_budget_left(default_budget), m_probing(false)
 {
 }
 
@@ -14,6 +15,9 @@ void task_wait_preparation_context::clear()
 {
 	m_pimpl->m_pollfds.clear();
 	m_pimpl->m_finished_tasks = 0;
+	m_routes.clear();
+	m_deadline_us = no_deadline;
+	m_budget_left = m_budget;
 }
 
 task_wait_checkpoint task_wait_preparation_context::checkpoint() const
@@ -21,6 +25,7 @@ task_wait_checkpoint task_wait_preparation_context::checkpoint() const
 	task_wait_checkpoint res;
 	res.finished_task_count = m_pimpl->m_finished_tasks;
 	res.poll_item_count = m_pimpl->m_pollfds.size();
+	res.route_count = m_routes.size();
 	return res;
 }
 
@@ -28,3 +33,10 @@ void task_wait_preparation_context::set_finished()
 {
 	++m_pimpl->m_finished_tasks;
 }
+
+void task_wait_preparation_context::rollback(task_wait_checkpoint const & chkp) throw()
+{
+	m_pimpl->m_pollfds.resize(chkp.poll_item_count);
+	m_pimpl->m_finished_tasks = chkp.finished_task_count;
+	m_routes.truncate(chkp.route_count, chkp.poll_item_count);
+}
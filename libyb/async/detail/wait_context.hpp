@@ -3,6 +3,10 @@
 
 #include "../../utils/noncopyable.hpp"
 #include <memory> // unique_ptr
+#include <vector>
+#include <algorithm> // reverse
+#include <stddef.h>
+#include <stdint.h>
 
 namespace yb {
 
@@ -13,6 +17,95 @@ struct task_wait_checkpoint
 {
 	size_t poll_item_count;
 	size_t finished_task_count;
+	size_t route_count;
+};
+
+// Remembers, for every poll item, the chain of child slots leading
+// to the task that added it. Composite tasks enter a slot for each child
+// they prepare, so that finalization can go straight to the child
+// that owns the selected poll item instead of testing every memento.
+class task_wait_route_table
+{
+public:
+	static size_t const npos = (size_t)-1;
+
+	task_wait_route_table()
+		: m_current(npos)
+	{
+	}
+
+	void clear()
+	{
+		m_entries.clear();
+		m_owners.clear();
+		m_current = npos;
+	}
+
+	size_t size() const
+	{
+		return m_entries.size();
+	}
+
+	void enter(size_t slot, size_t poll_item_count)
+	{
+		entry e = { m_current, slot, poll_item_count };
+		m_entries.push_back(e);
+		m_current = m_entries.size() - 1;
+	}
+
+	// Poll items added since the matching `enter` that aren't owned
+	// by a nested slot yet are assigned to the current one.
+	void leave(size_t poll_item_count) throw()
+	{
+		entry const & e = m_entries[m_current];
+		if (m_owners.size() < poll_item_count)
+		{
+			try
+			{
+				if (m_owners.size() < e.poll_item_first)
+					m_owners.resize(e.poll_item_first, (size_t)npos);
+				m_owners.resize(poll_item_count, m_current);
+			}
+			catch (...)
+			{
+				// The items stay unowned and are found by a scan.
+			}
+		}
+
+		m_current = e.parent;
+	}
+
+	void truncate(size_t route_count, size_t poll_item_count) throw()
+	{
+		m_entries.resize(route_count);
+		if (m_owners.size() > poll_item_count)
+			m_owners.resize(poll_item_count);
+	}
+
+	// Fills `route` with the slots leading to the owner of `poll_item`,
+	// outermost first. The route is empty if the item has no owner.
+	void get_route(size_t poll_item, std::vector<size_t> & route) const
+	{
+		route.clear();
+		if (poll_item >= m_owners.size())
+			return;
+
+		for (size_t i = m_owners[poll_item]; i != npos; i = m_entries[i].parent)
+			route.push_back(m_entries[i].slot);
+		std::reverse(route.begin(), route.end());
+	}
+
+private:
+	struct entry
+	{
+		size_t parent;
+		size_t slot;
+		size_t poll_item_first;
+	};
+
+	std::vector<entry> m_entries;
+	std::vector<size_t> m_owners;
+	size_t m_current;
 };
 
 struct task_wait_memento
@@ -35,21 +128,100 @@ public:
 	task_wait_preparation_context_impl * get() const;
 	task_wait_checkpoint checkpoint() const;
 
+	// Drops the poll items and finished tasks recorded since `chkp`.
+	void rollback(task_wait_checkpoint const & chkp) throw();
+
+	task_wait_route_table & routes() { return m_routes; }
+	task_wait_route_table const & routes() const { return m_routes; }
+
+	// Asks the runner to finish the wait no later than `deadline_us`,
+	// as measured by `clock_now_us`. The earliest deadline wins;
+	// a rollback keeps it, which only makes the runner wake up early.
+	static uint64_t const no_deadline = ~(uint64_t)0;
+
+	void add_deadline(uint64_t deadline_us)
+	{
+		if (deadline_us < m_deadline_us)
+			m_deadline_us = deadline_us;
+	}
+
+	uint64_t deadline() const
+	{
+		return m_deadline_us;
+	}
+
+	// Set while `task<R>::normalize` probes whether a new continuation
+	// is ready on the spot. Whatever is added to the context meanwhile
+	// is rolled back and the runner prepares the task again, so tasks
+	// whose `prepare_wait` advances their own state, such as a yield,
+	// must leave it alone while probing.
+	bool probing() const
+	{
+		return m_probing;
+	}
+
+	void set_probing(bool probing)
+	{
+		m_probing = probing;
+	}
+
+	// Limits the synchronous steps, such as loop iterations that
+	// complete without waiting, that tasks take in one runner round.
+	// A task that runs out yields and continues in the next round.
+	// `clear` refills the budget.
+	static size_t const default_budget = 1024;
+
+	void set_budget(size_t budget)
+	{
+		m_budget = budget;
+		m_budget_left = budget;
+	}
+
+	bool consume_budget()
+	{
+		if (m_budget_left == 0)
+			return false;
+		--m_budget_left;
+		return true;
+	}
+
 private:
 	std::unique_ptr<task_wait_preparation_context_impl> m_pimpl;
+	task_wait_route_table m_routes;
+	uint64_t m_deadline_us;
+	size_t m_budget;
+	size_t m_budget_left;
+	bool m_probing;
 };
 
+// Records the range of poll items added by a child task. Composite tasks
+// that can find a child by its index pass it as `slot`; the child can
+// then be found with `task_wait_route_step` during finalization.
 class task_wait_memento_builder
 	: noncopyable
 {
 public:
 	task_wait_memento_builder(task_wait_preparation_context & ctx) throw()
-		: m_ctx(ctx), m_checkpoint(ctx.checkpoint())
+		: m_ctx(ctx), m_checkpoint(ctx.checkpoint()), m_routed(false)
+	{
+	}
+
+	task_wait_memento_builder(task_wait_preparation_context & ctx, size_t slot)
+		: m_ctx(ctx), m_checkpoint(ctx.checkpoint()), m_routed(false)
+	{
+		m_ctx.routes().enter(slot, m_checkpoint.poll_item_count);
+		m_routed = true;
+	}
+
+	~task_wait_memento_builder()
 	{
+		this->leave();
 	}
 
 	task_wait_memento finish() throw()
 	{
+		this->leave();
+
 		task_wait_checkpoint chkp = m_ctx.checkpoint();
 
 		task_wait_memento res;
@@ -60,13 +232,28 @@ public:
 	}
 
 private:
+	void leave() throw()
+	{
+		if (m_routed)
+		{
+			m_ctx.routes().leave(m_ctx.checkpoint().poll_item_count);
+			m_routed = false;
+		}
+	}
+
 	task_wait_preparation_context & m_ctx;
 	task_wait_checkpoint m_checkpoint;
+	bool m_routed;
 };
 
 class task_wait_finalization_context
 {
 public:
+	task_wait_finalization_context()
+		: prep_ctx(0), finished_tasks(0), selected_poll_item(0), m_route_depth(0), m_route_valid(false)
+	{
+	}
+
 	task_wait_preparation_context * prep_ctx;
 	size_t finished_tasks;
 	size_t selected_poll_item;
@@ -76,6 +263,65 @@ public:
 		return (finished_tasks && m.finished_task_count != 0)
 			|| (!finished_tasks && m.poll_item_first <= selected_poll_item && selected_poll_item < m.poll_item_last);
 	}
+
+private:
+	std::vector<size_t> m_route;
+	size_t m_route_depth;
+	bool m_route_valid;
+
+	friend class task_wait_route_step;
+};
+
+// Taken by a composite task while finishing its children. `slot()`
+// is the slot the selected poll item was routed through when
+// the composite prepared its children, or `npos` if it isn't known;
+// the composite must still check the child's memento before trusting it,
+// since the tree may have changed since the wait was prepared.
+class task_wait_route_step
+	: noncopyable
+{
+public:
+	static size_t const npos = (size_t)-1;
+
+	explicit task_wait_route_step(task_wait_finalization_context & ctx) throw()
+		: m_ctx(ctx), m_slot(npos)
+	{
+		if (m_ctx.finished_tasks)
+			return;
+
+		if (!m_ctx.m_route_valid)
+		{
+			try
+			{
+				m_ctx.prep_ctx->routes().get_route(m_ctx.selected_poll_item, m_ctx.m_route);
+			}
+			catch (...)
+			{
+				m_ctx.m_route.clear();
+			}
+
+			m_ctx.m_route_valid = true;
+		}
+
+		if (m_ctx.m_route_depth < m_ctx.m_route.size())
+			m_slot = m_ctx.m_route[m_ctx.m_route_depth];
+		++m_ctx.m_route_depth;
+	}
+
+	~task_wait_route_step()
+	{
+		if (!m_ctx.finished_tasks)
+			--m_ctx.m_route_depth;
+	}
+
+	size_t slot() const
+	{
+		return m_slot;
+	}
+
+private:
+	task_wait_finalization_context & m_ctx;
+	size_t m_slot;
 };
 
 } // namespace yb
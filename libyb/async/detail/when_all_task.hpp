@@ -0,0 +1,364 @@
+#ifndef LIBYB_ASYNC_DETAIL_WHEN_ALL_TASK_HPP
+#define LIBYB_ASYNC_DETAIL_WHEN_ALL_TASK_HPP
+
+#include "../task_base.hpp"
+#include "../task.hpp"
+#include "wait_context.hpp"
+#include <tuple>
+#include <utility>
+#include <exception>
+
+namespace yb {
+
+// Takes the place of a `task<void>`'s value in the tuple produced by `when_all`.
+struct void_result
+{
+};
+
+namespace detail {
+
+template <typename R>
+struct group_value
+{
+	typedef R type;
+
+	static R get(task_result<R> && r)
+	{
+		return r.get();
+	}
+};
+
+template <>
+struct group_value<void>
+{
+	typedef void_result type;
+
+	static void_result get(task_result<void> && r)
+	{
+		r.get();
+		return void_result();
+	}
+};
+
+template <typename R>
+task_result<void> peek_failure(task<R> & t)
+{
+	task_result<R> r = t.get_result();
+	task_result<void> res = r.has_exception()? failed_result<void>(r): task_result<void>();
+	t = async::result(std::move(r));
+	return res;
+}
+
+inline bool any_task()
+{
+	return false;
+}
+
+template <typename R0, typename... R>
+bool any_task(task<R0> const & t, task<R> const &... ts)
+{
+	return t.has_task() || any_task(ts...);
+}
+
+// A fixed set of heterogeneous child tasks, stored inline.
+// The children are indexed from `I` up; `npos` never matches a child.
+template <size_t I, typename... R>
+class task_group
+{
+public:
+	static size_t const npos = (size_t)-1;
+
+	void cancel(cancel_level, size_t) throw() {}
+	void cancel_and_wait() throw() {}
+	void prepare_wait(task_wait_preparation_context &) {}
+	void finish_wait(task_wait_finalization_context &) throw() {}
+	bool finish_wait_at(task_wait_finalization_context &, size_t) throw() { return false; }
+
+	size_t pending_count() const { return 0; }
+	size_t first_completed() const { return npos; }
+
+	task_result<void> first_failure() { return task_result<void>(); }
+	task_result<void> failure_at(size_t) { return task_result<void>(); }
+
+	std::tuple<> values() { return std::tuple<>(); }
+	std::tuple<> results() { return std::tuple<>(); }
+};
+
+template <size_t I, typename R0, typename... R>
+class task_group<I, R0, R...>
+	: public task_group<I + 1, R...>
+{
+	typedef task_group<I + 1, R...> base_type;
+
+public:
+	explicit task_group(task<R0> && t, task<R> &&... ts)
+		: base_type(std::move(ts)...), m_task(std::move(t))
+	{
+		assert(!m_task.empty());
+	}
+
+	void cancel(cancel_level cl, size_t except) throw()
+	{
+		if (I != except)
+			m_task.cancel(cl);
+		base_type::cancel(cl, except);
+	}
+
+	void cancel_and_wait() throw()
+	{
+		if (m_task.has_task())
+			m_task = async::result(m_task.cancel_and_wait());
+		base_type::cancel_and_wait();
+	}
+
+	void prepare_wait(task_wait_preparation_context & ctx)
+	{
+		if (m_task.has_task())
+		{
+			task_wait_memento_builder mb(ctx, I);
+			m_task.prepare_wait(ctx);
+			m_memento = mb.finish();
+		}
+
+		base_type::prepare_wait(ctx);
+	}
+
+	void finish_wait(task_wait_finalization_context & ctx) throw()
+	{
+		if (m_task.has_task() && ctx.contains(m_memento))
+			m_task.finish_wait(ctx);
+		base_type::finish_wait(ctx);
+	}
+
+	// Finishes only the child in `slot`; returns false if the slot
+	// doesn't hold a pending child that owns the selected poll item.
+	bool finish_wait_at(task_wait_finalization_context & ctx, size_t slot) throw()
+	{
+		if (slot != I)
+			return base_type::finish_wait_at(ctx, slot);
+		if (!m_task.has_task() || !ctx.contains(m_memento))
+			return false;
+		m_task.finish_wait(ctx);
+		return true;
+	}
+
+	size_t pending_count() const
+	{
+		return (m_task.has_task()? 1: 0) + base_type::pending_count();
+	}
+
+	size_t first_completed() const
+	{
+		return m_task.has_result()? I: base_type::first_completed();
+	}
+
+	task_result<void> first_failure()
+	{
+		if (m_task.has_result())
+		{
+			task_result<void> r = peek_failure(m_task);
+			if (r.has_exception())
+				return r;
+		}
+
+		return base_type::first_failure();
+	}
+
+	task_result<void> failure_at(size_t index)
+	{
+		if (index != I)
+			return base_type::failure_at(index);
+		assert(m_task.has_result());
+		return peek_failure(m_task);
+	}
+
+	std::tuple<typename group_value<R0>::type, typename group_value<R>::type...> values()
+	{
+		return std::tuple_cat(
+			std::tuple<typename group_value<R0>::type>(group_value<R0>::get(m_task.get_result())),
+			base_type::values());
+	}
+
+	std::tuple<task_result<R0>, task_result<R>...> results()
+	{
+		return std::tuple_cat(
+			std::tuple<task_result<R0> >(m_task.get_result()),
+			base_type::results());
+	}
+
+private:
+	task<R0> m_task;
+	task_wait_memento m_memento;
+};
+
+// Goes straight to the child the selected poll item was routed through
+// and only falls back to testing every child's memento without a route.
+template <typename... R>
+void finish_group(task_group<0, R...> & group, task_wait_finalization_context & ctx) throw()
+{
+	task_wait_route_step step(ctx);
+	if (!group.finish_wait_at(ctx, step.slot()))
+		group.finish_wait(ctx);
+}
+
+template <typename... R>
+struct when_all_result
+{
+	typedef std::tuple<typename group_value<R>::type...> type;
+};
+
+template <typename... R>
+task<typename when_all_result<R...>::type> make_when_all_result(task_group<0, R...> & group, task_result<void> const & failure)
+{
+	typedef typename when_all_result<R...>::type result_type;
+
+	if (failure.has_exception())
+		return async::fail<result_type>(failure);
+
+	task_result<void> r = group.first_failure();
+	if (r.has_exception())
+		return async::fail<result_type>(r);
+
+	try
+	{
+		return async::value(group.values());
+	}
+	catch (...)
+	{
+		return async::raise<result_type>();
+	}
+}
+
+template <typename... R>
+struct when_any_result
+{
+	typedef std::pair<size_t, std::tuple<task_result<R>...> > type;
+};
+
+template <typename... R>
+task<typename when_any_result<R...>::type> make_when_any_result(task_group<0, R...> & group, size_t winner)
+{
+	typedef typename when_any_result<R...>::type result_type;
+
+	task_result<void> r = group.failure_at(winner);
+	if (r.has_exception())
+		return async::fail<result_type>(r);
+
+	try
+	{
+		return async::value(result_type(winner, group.results()));
+	}
+	catch (...)
+	{
+		return async::raise<result_type>();
+	}
+}
+
+template <typename... R>
+class when_all_task
+	: public task_base<typename when_all_result<R...>::type>
+{
+public:
+	typedef typename when_all_result<R...>::type result_type;
+
+	explicit when_all_task(task<R> &&... ts)
+		: m_group(std::move(ts)...), m_failure(m_group.first_failure())
+	{
+		if (m_failure.has_exception())
+			m_group.cancel(cl_abort, m_group.npos);
+	}
+
+	void cancel(cancel_level cl) throw()
+	{
+		m_group.cancel(cl, m_group.npos);
+	}
+
+	task_result<result_type> cancel_and_wait() throw()
+	{
+		m_group.cancel_and_wait();
+		return make_when_all_result(m_group, m_failure).get_result();
+	}
+
+	void prepare_wait(task_wait_preparation_context & ctx)
+	{
+		m_group.prepare_wait(ctx);
+	}
+
+	task<result_type> finish_wait(task_wait_finalization_context & ctx) throw()
+	{
+		finish_group(m_group, ctx);
+
+		if (m_failure.has_value())
+		{
+			m_failure = m_group.first_failure();
+			if (m_failure.has_exception())
+				m_group.cancel(cl_abort, m_group.npos);
+		}
+
+		if (m_group.pending_count() != 0)
+			return nulltask;
+		return make_when_all_result(m_group, m_failure);
+	}
+
+private:
+	task_group<0, R...> m_group;
+	task_result<void> m_failure;
+};
+
+template <typename... R>
+class when_any_task
+	: public task_base<typename when_any_result<R...>::type>
+{
+public:
+	typedef typename when_any_result<R...>::type result_type;
+
+	explicit when_any_task(task<R> &&... ts)
+		: m_group(std::move(ts)...), m_winner(m_group.first_completed())
+	{
+		if (m_winner != m_group.npos)
+			m_group.cancel(cl_abort, m_winner);
+	}
+
+	void cancel(cancel_level cl) throw()
+	{
+		m_group.cancel(cl, m_group.npos);
+	}
+
+	task_result<result_type> cancel_and_wait() throw()
+	{
+		m_group.cancel_and_wait();
+		if (m_winner == m_group.npos)
+			m_winner = m_group.first_completed();
+		return make_when_any_result(m_group, m_winner).get_result();
+	}
+
+	void prepare_wait(task_wait_preparation_context & ctx)
+	{
+		m_group.prepare_wait(ctx);
+	}
+
+	task<result_type> finish_wait(task_wait_finalization_context & ctx) throw()
+	{
+		finish_group(m_group, ctx);
+
+		if (m_winner == m_group.npos)
+		{
+			m_winner = m_group.first_completed();
+			if (m_winner != m_group.npos)
+				m_group.cancel(cl_abort, m_winner);
+		}
+
+		if (m_group.pending_count() != 0)
+			return nulltask;
+		return make_when_any_result(m_group, m_winner);
+	}
+
+private:
+	task_group<0, R...> m_group;
+	size_t m_winner;
+};
+
+} // namespace detail
+} // namespace yb
+
+#endif // LIBYB_ASYNC_DETAIL_WHEN_ALL_TASK_HPP
@@ -14,7 +14,7 @@ void win32_affinity_task::cancel(cancel_level cl) throw()
 
 task_result<void> win32_affinity_task::cancel_and_wait() throw()
 {
-	return task_result<void>(std::make_exception_ptr(task_cancelled(cl_kill)));
+	return task_result<void>(te_cancelled);
 }
 
 void win32_affinity_task::prepare_wait(task_wait_preparation_context & ctx)
@@ -24,5 +24,5 @@ void win32_affinity_task::prepare_wait(task_wait_preparation_context & ctx)
 
 task<void> win32_affinity_task::finish_wait(task_wait_finalization_context &) throw()
 {
-	return m_cl != cl_none? async::raise<void>(task_cancelled(m_cl)): async::value();
+	return m_cl != cl_none? async::fail<void>(te_cancelled): async::value();
 }
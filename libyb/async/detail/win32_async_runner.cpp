@@ -1,7 +1,10 @@
 #include "../async_runner.hpp"
+#include "../clock.hpp"
 #include "../../utils/noncopyable.hpp"
 #include "win32_wait_context.hpp"
+#include "win32_handle_task.hpp"
 #include <list>
+#include <memory>
 #include <windows.h>
 #include <stdexcept>
 
@@ -60,6 +63,22 @@ void async_promise_base::wait()
 	WaitForSingleObject(m_pimpl->hFinishedEvent, INFINITE);
 }
 
+task<void> async_promise_base::wait_task()
+{
+	if (WaitForSingleObject(m_pimpl->hFinishedEvent, 0) == WAIT_OBJECT_0)
+		return async::value();
+
+	this->addref();
+	std::shared_ptr<async_promise_base> self(this, [](async_promise_base * p) {
+		p->release();
+	});
+
+	return make_win32_handle_task(m_pimpl->hFinishedEvent, [self](cancel_level cl) -> bool {
+		self->cancel(cl);
+		return true;
+	});
+}
+
 void async_promise_base::perform_pending_cancels()
 {
 	if (m_pimpl->m_applied_cancel < m_pimpl->m_requested_cancel)
@@ -155,7 +174,8 @@ struct parallel_promise
 struct async_runner::impl
 {
 	impl()
-		: hThread(0), stopped(false)
+		: hThread(0), stopped(false), work_budget(task_wait_preparation_context::default_budget),
+		iterations(0)
 	{
 		hQueueUpdated.attach(CreateEvent(0, FALSE, FALSE, 0));
 		if (!hQueueUpdated.get())
@@ -201,15 +221,21 @@ struct async_runner::impl
 		task_wait_preparation_context wait_ctx;
 		task_wait_preparation_context_impl & wait_ctx_impl = *wait_ctx.get();
 
+		// Rounds that only finish ready tasks alternate with rounds
+		// that wait, so that ready tasks can't hold back I/O.
+		bool poll_due = false;
+
 		for (;;)
 		{
-			wait_ctx.clear();
-
 			{
 				cs_holder l(queue_mutex);
 				if (stopped)
 					break;
 
+				++iterations;
+				wait_ctx.set_budget(work_budget);
+				wait_ctx.clear();
+
 				for (std::list<parallel_promise>::iterator it = promises.begin(); it != promises.end(); ++it)
 					it->promise->perform_pending_cancels();
 
@@ -225,28 +251,45 @@ struct async_runner::impl
 
 			wait_ctx_impl.m_handles.push_back(hQueueUpdated.get());
 
-			if (wait_ctx_impl.m_finished_tasks)
+			if (wait_ctx_impl.m_finished_tasks && !poll_due)
 			{
-				task_wait_finalization_context finish_ctx;
-				finish_ctx.finished_tasks = wait_ctx_impl.m_finished_tasks;
-				this->finish_wait(finish_ctx);
+				this->finish_ready(wait_ctx);
+				poll_due = true;
+				continue;
 			}
-			else
-			{
-				DWORD dwRes = WaitForMultipleObjects(wait_ctx_impl.m_handles.size(), wait_ctx_impl.m_handles.data(), FALSE, INFINITE);
-				assert(dwRes >= WAIT_OBJECT_0 && dwRes < WAIT_OBJECT_0 + wait_ctx_impl.m_handles.size());
 
-				if (dwRes - WAIT_OBJECT_0 == wait_ctx_impl.m_handles.size() - 1)
-					continue;
+			poll_due = false;
 
-				task_wait_finalization_context finish_ctx;
-				finish_ctx.finished_tasks = false;
-				finish_ctx.selected_poll_item = dwRes - WAIT_OBJECT_0;
-				this->finish_wait(finish_ctx);
+			int timeout = wait_ctx_impl.m_finished_tasks? 0: detail::deadline_timeout_ms(wait_ctx.deadline());
+			DWORD dwRes = WaitForMultipleObjects(wait_ctx_impl.m_handles.size(), wait_ctx_impl.m_handles.data(), FALSE, timeout < 0? INFINITE: (DWORD)timeout);
+			if (dwRes == WAIT_TIMEOUT)
+			{
+				if (wait_ctx_impl.m_finished_tasks)
+					this->finish_ready(wait_ctx);
+				continue;
 			}
+
+			assert(dwRes >= WAIT_OBJECT_0 && dwRes < WAIT_OBJECT_0 + wait_ctx_impl.m_handles.size());
+
+			if (dwRes - WAIT_OBJECT_0 == wait_ctx_impl.m_handles.size() - 1)
+				continue;
+
+			task_wait_finalization_context finish_ctx;
+			finish_ctx.prep_ctx = &wait_ctx;
+			finish_ctx.finished_tasks = false;
+			finish_ctx.selected_poll_item = dwRes - WAIT_OBJECT_0;
+			this->finish_wait(finish_ctx);
 		}
 	}
 
+	void finish_ready(task_wait_preparation_context & wait_ctx)
+	{
+		task_wait_finalization_context finish_ctx;
+		finish_ctx.prep_ctx = &wait_ctx;
+		finish_ctx.finished_tasks = wait_ctx.get()->m_finished_tasks;
+		this->finish_wait(finish_ctx);
+	}
+
 	void finish_wait(task_wait_finalization_context & ctx)
 	{
 		cs_holder l(queue_mutex);
@@ -292,6 +335,8 @@ struct async_runner::impl
 	handle_holder hQueueUpdated;
 
 	bool stopped;
+	size_t work_budget;
+	uint64_t iterations;
 };
 
 async_runner::async_runner()
@@ -304,6 +349,22 @@ async_runner::~async_runner()
 {
 }
 
+void async_runner::set_work_budget(size_t steps)
+{
+	cs_holder l(m_pimpl->queue_mutex);
+	m_pimpl->work_budget = steps;
+}
+
+async_runner_metrics async_runner::metrics() const
+{
+	cs_holder l(m_pimpl->queue_mutex);
+
+	async_runner_metrics res = {};
+	res.iterations = m_pimpl->iterations;
+	res.promise_count = m_pimpl->promises.size();
+	return res;
+}
+
 async_runner::submit_context::submit_context(async_runner & runner)
 	: m_runner(runner)
 {
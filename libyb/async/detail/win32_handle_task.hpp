@@ -60,7 +60,7 @@ void win32_handle_task<Canceller>::prepare_wait(task_wait_preparation_context &
 template <typename Canceller>
 task<void> win32_handle_task<Canceller>::finish_wait(task_wait_finalization_context &) throw()
 {
-	return m_handle? async::value(): async::raise<void>(task_cancelled());
+	return m_handle? async::value(): async::fail<void>(te_cancelled);
 }
 
 template <typename Canceller>
@@ -76,7 +76,7 @@ task_result<void> win32_handle_task<Canceller>::cancel_and_wait() throw()
 	}
 	else
 	{
-		return task_result<void>(std::make_exception_ptr(task_cancelled()));
+		return task_result<void>(te_cancelled);
 	}
 }
 
@@ -1,30 +1,62 @@
 #include "../sync_runner.hpp"
 #include "win32_wait_context.hpp"
+#include "../clock.hpp"
 using namespace yb;
 
 void sync_runner::poll_one(task_wait_preparation_context & wait_ctx)
 {
 	task_wait_preparation_context_impl & wait_ctx_impl = *wait_ctx.get();
 
+	wait_ctx.set_budget(m_work_budget);
 	wait_ctx.clear();
 	m_parallel_tasks.prepare_wait(wait_ctx);
 
-	if (wait_ctx_impl.m_finished_tasks)
+	if (wait_ctx_impl.m_finished_tasks && !m_poll_due)
 	{
 		task_wait_finalization_context finish_ctx;
+		finish_ctx.prep_ctx = &wait_ctx;
 		finish_ctx.finished_tasks = wait_ctx_impl.m_finished_tasks;
 		m_parallel_tasks.finish_wait(finish_ctx);
+		m_poll_due = true;
+		return;
 	}
-	else
-	{
-		assert(!wait_ctx_impl.m_handles.empty());
 
-		DWORD dwRes = WaitForMultipleObjects(wait_ctx_impl.m_handles.size(), wait_ctx_impl.m_handles.data(), FALSE, INFINITE);
-		assert(dwRes >= WAIT_OBJECT_0 && dwRes < WAIT_OBJECT_0 + wait_ctx_impl.m_handles.size());
+	m_poll_due = false;
 
-		task_wait_finalization_context finish_ctx;
-		finish_ctx.finished_tasks = false;
-		finish_ctx.selected_poll_item = dwRes - WAIT_OBJECT_0;
-		m_parallel_tasks.finish_wait(finish_ctx);
+	int timeout = wait_ctx_impl.m_finished_tasks? 0: detail::deadline_timeout_ms(wait_ctx.deadline());
+	assert(!wait_ctx_impl.m_handles.empty() || timeout >= 0);
+
+	DWORD dwRes = wait_ctx_impl.m_handles.empty()
+		? WAIT_TIMEOUT
+		: WaitForMultipleObjects(wait_ctx_impl.m_handles.size(), wait_ctx_impl.m_handles.data(), FALSE, timeout < 0? INFINITE: (DWORD)timeout);
+	if (dwRes == WAIT_TIMEOUT)
+	{
+		if (wait_ctx_impl.m_finished_tasks)
+		{
+			task_wait_finalization_context finish_ctx;
+			finish_ctx.prep_ctx = &wait_ctx;
+			finish_ctx.finished_tasks = wait_ctx_impl.m_finished_tasks;
+			m_parallel_tasks.finish_wait(finish_ctx);
+		}
+		else if (virtual_clock * clock = virtual_clock::current())
+		{
+			// A deadline passed; with a virtual clock, nothing was ready
+			// and time skips straight to the deadline.
+			clock->advance_to(wait_ctx.deadline());
+		}
+		else if (wait_ctx_impl.m_handles.empty())
+		{
+			Sleep(timeout);
+		}
+
+		return;
 	}
+
+	assert(dwRes >= WAIT_OBJECT_0 && dwRes < WAIT_OBJECT_0 + wait_ctx_impl.m_handles.size());
+
+	task_wait_finalization_context finish_ctx;
+	finish_ctx.prep_ctx = &wait_ctx;
+	finish_ctx.finished_tasks = false;
+	finish_ctx.selected_poll_item = dwRes - WAIT_OBJECT_0;
+	m_parallel_tasks.finish_wait(finish_ctx);
 }
@@ -1,4 +1,6 @@
 #include "../timer.hpp"
+#include "../clock.hpp"
+#include "deadline_task.hpp"
 #include "win32_handle_task.hpp"
 #include <stdexcept>
 using namespace yb;
@@ -23,8 +25,17 @@ timer::~timer()
 
 task<void> timer::wait_ms(int milliseconds)
 {
+	return this->wait_us(milliseconds * 1000ull);
+}
+
+task<void> timer::wait_us(uint64_t microseconds)
+{
+	if (virtual_clock * clock = virtual_clock::current())
+		return detail::make_deadline_task(clock->now_us() + microseconds);
+
+	// Waitable timers count in 100ns units; negative values are relative.
 	LARGE_INTEGER tout;
-	tout.QuadPart = milliseconds * -10*1000ull;
+	tout.QuadPart = -(LONGLONG)(microseconds * 10);
 	if (!SetWaitableTimer(m_pimpl->hTimer, &tout, 0, 0, 0, FALSE))
 		return async::raise<void>(std::runtime_error("couldn't set the timer"));
 
@@ -40,3 +51,51 @@ task<void> timer::wait_ms(int milliseconds)
 		}
 	});
 }
+
+task<void> timer::wait_until(uint64_t deadline_us)
+{
+	if (virtual_clock::current())
+		return detail::make_deadline_task(deadline_us);
+
+	// Absolute waitable timers follow the wall clock,
+	// so the deadline is converted to a relative wait.
+	uint64_t now = clock_now_us();
+	if (deadline_us <= now)
+		return async::value();
+	return this->wait_us(deadline_us - now);
+}
+
+// Periodic waitable timers neither report missed ticks nor go below
+// a millisecond, so the schedule is kept here on absolute deadlines.
+struct interval::impl
+{
+	timer tmr;
+	uint64_t period_us;
+	uint64_t next_tick_us;
+};
+
+interval::interval(uint64_t period_us)
+	: m_pimpl(new impl())
+{
+	assert(period_us > 0);
+	m_pimpl->period_us = period_us;
+	m_pimpl->next_tick_us = clock_now_us() + period_us;
+}
+
+interval::~interval()
+{
+}
+
+uint64_t interval::period_us() const
+{
+	return m_pimpl->period_us;
+}
+
+task<uint64_t> interval::wait()
+{
+	return m_pimpl->tmr.wait_until(m_pimpl->next_tick_us).then([this]() -> uint64_t {
+		uint64_t ticks = (clock_now_us() - m_pimpl->next_tick_us) / m_pimpl->period_us + 1;
+		m_pimpl->next_tick_us += ticks * m_pimpl->period_us;
+		return ticks;
+	});
+}
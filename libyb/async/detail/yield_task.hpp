@@ -0,0 +1,74 @@
+#ifndef LIBYB_ASYNC_DETAIL_YIELD_TASK_HPP
+#define LIBYB_ASYNC_DETAIL_YIELD_TASK_HPP
+
+#include "../task_base.hpp"
+#include "wait_context.hpp"
+
+namespace yb {
+namespace detail {
+
+// Isn't ready when first prepared, but asks the runner not to block,
+// so the runner polls for I/O before the task completes in a later round.
+// A probe by `task<R>::normalize` doesn't count as the first preparation.
+class yield_task
+	: public task_base<void>
+{
+public:
+	yield_task()
+		: m_prepared(false), m_ready(false)
+	{
+	}
+
+	void cancel(cancel_level) throw()
+	{
+	}
+
+	task_result<void> cancel_and_wait() throw()
+	{
+		return task_result<void>();
+	}
+
+	void prepare_wait(task_wait_preparation_context & ctx)
+	{
+		if (m_prepared)
+		{
+			m_ready = true;
+			ctx.set_finished();
+		}
+		else
+		{
+			if (!ctx.probing())
+				m_prepared = true;
+			ctx.add_deadline(0);
+		}
+	}
+
+	task<void> finish_wait(task_wait_finalization_context &) throw()
+	{
+		if (m_ready)
+			return async::value();
+		return nulltask;
+	}
+
+private:
+	bool m_prepared;
+	bool m_ready;
+};
+
+} // namespace detail
+
+inline task<void> async::yield()
+{
+	try
+	{
+		return task<void>(new detail::yield_task());
+	}
+	catch (...)
+	{
+		return async::raise<void>();
+	}
+}
+
+} // namespace yb
+
+#endif // LIBYB_ASYNC_DETAIL_YIELD_TASK_HPP
@@ -0,0 +1,66 @@
+#ifndef LIBYB_ASYNC_EMBEDDED_RUNNER_HPP
+#define LIBYB_ASYNC_EMBEDDED_RUNNER_HPP
+
+#include "task.hpp"
+#include "../utils/noncopyable.hpp"
+#include <memory>
+
+namespace yb {
+
+// Runs tasks from a foreign event loop on the loop's own thread.
+// The runner exposes a single file descriptor (an epoll fd on Linux)
+// that becomes readable whenever some of its tasks can make progress;
+// the loop watches it and calls `dispatch_ready` when it fires.
+// Deadlines are kept on the system clock by the same descriptor,
+// so a `virtual_clock` can't drive the runner; none may be installed
+// on the loop's thread.
+//
+// All calls must come from the thread that drives the loop.
+// Tasks still running when the runner is destroyed are cancelled
+// and waited for.
+class embedded_runner
+	: noncopyable
+{
+public:
+	embedded_runner();
+	~embedded_runner();
+
+	int native_handle() const;
+
+	// Finishes the waits that are ready and never blocks.
+	void dispatch_ready();
+
+	// Returns true if no task is running.
+	bool empty() const;
+
+	void cancel(cancel_level cl);
+
+	// Sets the number of synchronous steps tasks may take in one dispatch
+	// before they yield; see `task_wait_preparation_context::set_budget`.
+	void set_work_budget(size_t steps);
+
+	template <typename T>
+	void post_detached(task<T> && t)
+	{
+		assert(!t.empty());
+		if (t.has_task())
+			this->post_task(t.ignore_result());
+	}
+
+	template <typename T>
+	friend embedded_runner & operator|=(embedded_runner & r, task<T> && t)
+	{
+		r.post_detached(std::move(t));
+		return r;
+	}
+
+private:
+	void post_task(task<void> && t);
+
+	struct impl;
+	std::unique_ptr<impl> m_pimpl;
+};
+
+} // namespace yb
+
+#endif // LIBYB_ASYNC_EMBEDDED_RUNNER_HPP
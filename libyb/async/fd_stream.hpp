@@ -0,0 +1,64 @@
+#ifndef LIBYB_ASYNC_FD_STREAM_HPP
+#define LIBYB_ASYNC_FD_STREAM_HPP
+
+#include "stream.hpp"
+#include "../utils/noncopyable.hpp"
+
+namespace yb {
+
+// A stream over file descriptors: pipes, ptys, sockets, eventfds or ttys.
+// The descriptors are switched to non-blocking mode; reads and writes
+// try the syscall first and only wait for the descriptor when it would
+// block. A read at the end of the stream fails with `te_eof`, as does
+// a write once the peer has gone away or the writing side was shut down.
+class fd_stream
+	: public stream, noncopyable
+{
+public:
+	fd_stream();
+
+	// Adopts `fd` for both directions; the stream closes it.
+	explicit fd_stream(int fd);
+
+	// Adopts a pair of one-way descriptors, e.g. the ends of two pipes.
+	fd_stream(int read_fd, int write_fd);
+
+	~fd_stream();
+
+	void attach(int fd);
+	void attach(int read_fd, int write_fd);
+	void close();
+
+	bool is_open() const;
+	int read_handle() const;
+	int write_handle() const;
+
+	// Signals the end of the stream to the peer while reads go on.
+	// Sockets are shut down for writing; a separate write descriptor
+	// is closed. A descriptor used both ways that isn't a socket can't
+	// be half-closed and the call throws.
+	void shutdown_write();
+
+	task<size_t> read(uint8_t * buffer, size_t size);
+	task<size_t> write(uint8_t const * buffer, size_t size);
+
+	// Map to readv(2) and writev(2), or sendmsg(2) for sockets;
+	// at most `max_segments` segments are transferred per call.
+	static size_t const max_segments = 16;
+	task<size_t> readv(read_segment const * segments, size_t count);
+	task<size_t> writev(buffer_ref const * segments, size_t count);
+
+	// Uses splice(2) if `source` is an `fd_stream` as well and one
+	// of the two descriptors is a pipe.
+	task<void> splice_from(stream & source, size_t buffer_size);
+
+private:
+	int m_read_fd;
+	int m_write_fd;
+	bool m_write_socket;
+	bool m_write_shut;
+};
+
+} // namespace yb
+
+#endif // LIBYB_ASYNC_FD_STREAM_HPP
@@ -0,0 +1,69 @@
+#include "mapped_file_stream.hpp"
+#include <algorithm>
+#include <stdexcept>
+#include <cassert>
+using namespace yb;
+
+mapped_file_stream::mapped_file_stream()
+	: m_position(0)
+{
+}
+
+mapped_file_stream::mapped_file_stream(string_ref const & path)
+	: m_file(path), m_position(0)
+{
+}
+
+void mapped_file_stream::open(string_ref const & path)
+{
+	m_file.open(path);
+	m_position = 0;
+}
+
+void mapped_file_stream::close()
+{
+	m_file.close();
+	m_position = 0;
+}
+
+void mapped_file_stream::seek(size_t position)
+{
+	assert(position <= m_file.size());
+	m_position = position;
+}
+
+task<size_t> mapped_file_stream::read(uint8_t * buffer, size_t size)
+{
+	read_segment seg = { buffer, size };
+	return this->readv(&seg, 1);
+}
+
+task<size_t> mapped_file_stream::readv(read_segment const * segments, size_t count)
+{
+	size_t total = 0;
+	for (size_t i = 0; i < count; ++i)
+		total += segments[i].size;
+
+	if (total == 0)
+		return async::value((size_t)0);
+	if (m_position == m_file.size())
+		return async::fail<size_t>(te_eof);
+
+	size_t res = 0;
+	for (size_t i = 0; i < count && m_position != m_file.size(); ++i)
+	{
+		size_t chunk = (std::min)(segments[i].size, m_file.size() - m_position);
+		std::copy(m_file.data() + m_position, m_file.data() + m_position + chunk, segments[i].data);
+		m_position += chunk;
+		res += chunk;
+	}
+
+	return async::value(res);
+}
+
+task<size_t> mapped_file_stream::write(uint8_t const * buffer, size_t size)
+{
+	(void)buffer;
+	(void)size;
+	return async::raise<size_t>(std::logic_error("mapped_file_stream is read-only"));
+}
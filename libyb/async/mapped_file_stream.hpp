@@ -0,0 +1,38 @@
+#ifndef LIBYB_ASYNC_MAPPED_FILE_STREAM_HPP
+#define LIBYB_ASYNC_MAPPED_FILE_STREAM_HPP
+
+#include "stream.hpp"
+#include "../utils/mapped_file.hpp"
+
+namespace yb {
+
+// A read-only stream over a memory-mapped file, e.g. as a source
+// for `copy`. Reads complete immediately; once the whole file
+// has been read, they fail with `te_eof`. Writes always fail.
+class mapped_file_stream
+	: public stream, noncopyable
+{
+public:
+	mapped_file_stream();
+	explicit mapped_file_stream(string_ref const & path);
+
+	void open(string_ref const & path);
+	void close();
+
+	mapped_file const & file() const { return m_file; }
+
+	size_t position() const { return m_position; }
+	void seek(size_t position);
+
+	task<size_t> read(uint8_t * buffer, size_t size);
+	task<size_t> write(uint8_t const * buffer, size_t size);
+	task<size_t> readv(read_segment const * segments, size_t count);
+
+private:
+	mapped_file m_file;
+	size_t m_position;
+};
+
+} // namespace yb
+
+#endif // LIBYB_ASYNC_MAPPED_FILE_STREAM_HPP
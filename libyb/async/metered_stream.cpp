@@ -0,0 +1,152 @@
+#include "metered_stream.hpp"
+#include "clock.hpp"
+#include <cstring>
+using namespace yb;
+
+size_t log_histogram::bucket(uint64_t value)
+{
+	size_t res = 0;
+	while (value != 0 && res < bucket_count - 1)
+	{
+		value >>= 1;
+		++res;
+	}
+	return res;
+}
+
+uint64_t log_histogram::bucket_floor(size_t bucket)
+{
+	return bucket == 0? 0: (uint64_t)1 << (bucket - 1);
+}
+
+uint64_t log_histogram::quantile_floor(double fraction) const
+{
+	uint64_t total = 0;
+	for (size_t i = 0; i < bucket_count; ++i)
+		total += counts[i];
+	if (total == 0)
+		return 0;
+
+	uint64_t rank = (uint64_t)(fraction * (total - 1));
+	for (size_t i = 0; i < bucket_count; ++i)
+	{
+		if (rank < counts[i])
+			return bucket_floor(i);
+		rank -= counts[i];
+	}
+	return bucket_floor(bucket_count - 1);
+}
+
+metered_stream::metered_stream(stream & s)
+	: m_stream(s)
+{
+	m_lock.clear();
+	std::memset(&m_stats, 0, sizeof m_stats);
+}
+
+// The lock is only held to copy the statistics in or out,
+// a spin lock suffices.
+void metered_stream::lock() const
+{
+	while (m_lock.test_and_set(std::memory_order_acquire))
+	{
+	}
+}
+
+void metered_stream::unlock() const
+{
+	m_lock.clear(std::memory_order_release);
+}
+
+stream_stats metered_stream::stats() const
+{
+	this->lock();
+	stream_stats res = m_stats;
+	this->unlock();
+	return res;
+}
+
+void metered_stream::reset_stats()
+{
+	this->lock();
+	size_t in_flight = m_stats.in_flight;
+	std::memset(&m_stats, 0, sizeof m_stats);
+	m_stats.in_flight = in_flight;
+	m_stats.max_in_flight = in_flight;
+	this->unlock();
+}
+
+void metered_stream::start()
+{
+	this->lock();
+	if (++m_stats.in_flight > m_stats.max_in_flight)
+		m_stats.max_in_flight = m_stats.in_flight;
+	this->unlock();
+}
+
+void metered_stream::record(bool write, uint64_t start_us, task_result<size_t> & r)
+{
+	uint64_t latency = clock_now_us() - start_us;
+
+	this->lock();
+	--m_stats.in_flight;
+	if (r.has_exception())
+	{
+		++(write? m_stats.failed_writes: m_stats.failed_reads);
+	}
+	else if (write)
+	{
+		++m_stats.writes;
+		m_stats.bytes_written += r.get();
+		m_stats.write_size.add(r.get());
+		m_stats.write_latency_us.add(latency);
+	}
+	else
+	{
+		++m_stats.reads;
+		m_stats.bytes_read += r.get();
+		m_stats.read_size.add(r.get());
+		m_stats.read_latency_us.add(latency);
+	}
+	this->unlock();
+}
+
+task<size_t> metered_stream::read(uint8_t * buffer, size_t size)
+{
+	uint64_t start_us = clock_now_us();
+	this->start();
+	return m_stream.read(buffer, size).continue_with([this, start_us](task_result<size_t> r) {
+		this->record(false, start_us, r);
+		return async::result(std::move(r));
+	});
+}
+
+task<size_t> metered_stream::write(uint8_t const * buffer, size_t size)
+{
+	uint64_t start_us = clock_now_us();
+	this->start();
+	return m_stream.write(buffer, size).continue_with([this, start_us](task_result<size_t> r) {
+		this->record(true, start_us, r);
+		return async::result(std::move(r));
+	});
+}
+
+task<size_t> metered_stream::readv(read_segment const * segments, size_t count)
+{
+	uint64_t start_us = clock_now_us();
+	this->start();
+	return m_stream.readv(segments, count).continue_with([this, start_us](task_result<size_t> r) {
+		this->record(false, start_us, r);
+		return async::result(std::move(r));
+	});
+}
+
+task<size_t> metered_stream::writev(buffer_ref const * segments, size_t count)
+{
+	uint64_t start_us = clock_now_us();
+	this->start();
+	return m_stream.writev(segments, count).continue_with([this, start_us](task_result<size_t> r) {
+		this->record(true, start_us, r);
+		return async::result(std::move(r));
+	});
+}
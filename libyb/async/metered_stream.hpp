@@ -0,0 +1,81 @@
+#ifndef LIBYB_ASYNC_METERED_STREAM_HPP
+#define LIBYB_ASYNC_METERED_STREAM_HPP
+
+#include "stream.hpp"
+#include "../utils/noncopyable.hpp"
+#include <atomic>
+#include <stdint.h>
+
+namespace yb {
+
+// Counts values in power-of-two buckets: bucket 0 holds zeros,
+// bucket i holds values in [2^(i-1), 2^i), and the last bucket
+// holds everything above.
+struct log_histogram
+{
+	static size_t const bucket_count = 32;
+
+	static size_t bucket(uint64_t value);
+	static uint64_t bucket_floor(size_t bucket);
+
+	void add(uint64_t value) { ++counts[bucket(value)]; }
+
+	// Returns the lower bound of the bucket containing
+	// the `fraction`-quantile of the recorded values.
+	uint64_t quantile_floor(double fraction) const;
+
+	uint64_t counts[bucket_count];
+};
+
+struct stream_stats
+{
+	uint64_t reads;
+	uint64_t writes;
+	uint64_t failed_reads;
+	uint64_t failed_writes;
+	uint64_t bytes_read;
+	uint64_t bytes_written;
+
+	size_t in_flight;
+	size_t max_in_flight;
+
+	// Latencies are in microseconds, from the call to the completion.
+	log_histogram read_latency_us;
+	log_histogram write_latency_us;
+	log_histogram read_size;
+	log_histogram write_size;
+};
+
+// Passes everything through to `s` and keeps statistics
+// of the transfers. The statistics are updated on the runner's thread
+// as transfers complete; `stats` may be called from any thread
+// and returns a consistent snapshot.
+class metered_stream
+	: public stream, noncopyable
+{
+public:
+	explicit metered_stream(stream & s);
+
+	stream_stats stats() const;
+	void reset_stats();
+
+	task<size_t> read(uint8_t * buffer, size_t size);
+	task<size_t> write(uint8_t const * buffer, size_t size);
+	task<size_t> readv(read_segment const * segments, size_t count);
+	task<size_t> writev(buffer_ref const * segments, size_t count);
+
+private:
+	void start();
+	void record(bool write, uint64_t start_us, task_result<size_t> & r);
+
+	void lock() const;
+	void unlock() const;
+
+	stream & m_stream;
+	stream_stats m_stats;
+	mutable std::atomic_flag m_lock;
+};
+
+} // namespace yb
+
+#endif // LIBYB_ASYNC_METERED_STREAM_HPP
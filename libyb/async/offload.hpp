@@ -0,0 +1,63 @@
+#ifndef LIBYB_ASYNC_OFFLOAD_HPP
+#define LIBYB_ASYNC_OFFLOAD_HPP
+
+#include "task.hpp"
+#include "detail/offload_job.hpp"
+#include "../utils/noncopyable.hpp"
+#include <memory>
+
+namespace yb {
+
+// A fixed set of worker threads for blocking system calls
+// and CPU-bound work that must not stall a runner.
+// Only implemented on Linux.
+class thread_pool
+	: noncopyable
+{
+public:
+	// If `thread_count` is zero, one worker per online CPU is started.
+	explicit thread_pool(size_t thread_count = 0);
+
+	// Finishes the jobs that are already queued, then joins the workers.
+	~thread_pool();
+
+	size_t thread_count() const;
+
+	void post(std::shared_ptr<detail::offload_job_base> const & job);
+
+private:
+	struct impl;
+	std::unique_ptr<impl> m_pimpl;
+};
+
+// Runs `f` on one of the workers in `pool`. The returned task completes
+// on whichever runner waits for it; the runner thread is never blocked.
+//
+// A job that didn't start yet is dropped when the task is cancelled
+// with `cl_abort` or higher. A job that is already running can't be
+// interrupted and the task only completes once `f` returns.
+template <typename F>
+task<typename detail::offload_result<F>::type> offload(thread_pool & pool, F f);
+
+} // namespace yb
+
+template <typename F>
+yb::task<typename yb::detail::offload_result<F>::type> yb::offload(thread_pool & pool, F f)
+{
+	typedef typename detail::offload_result<F>::type result_type;
+
+	try
+	{
+		std::shared_ptr<detail::offload_job<result_type, F> > job(new detail::offload_job<result_type, F>(std::move(f)));
+		pool.post(job);
+		return detail::offload_job_base::wait_done(job).then([job] {
+			return job->get_result();
+		});
+	}
+	catch (...)
+	{
+		return async::raise<result_type>();
+	}
+}
+
+#endif // LIBYB_ASYNC_OFFLOAD_HPP
@@ -0,0 +1,71 @@
+#include "paced_stream.hpp"
+#include "clock.hpp"
+#include "detail/deadline_task.hpp"
+#include <algorithm>
+#include <cassert>
+using namespace yb;
+
+static uint64_t const credit_per_byte = 1000000;
+
+paced_stream::paced_stream(stream & s, uint64_t bytes_per_second, size_t max_burst)
+	: m_stream(s)
+{
+	this->set_rate(bytes_per_second, max_burst);
+}
+
+void paced_stream::set_rate(uint64_t bytes_per_second, size_t max_burst)
+{
+	assert(bytes_per_second == 0 || max_burst != 0);
+
+	m_rate = bytes_per_second;
+	m_capacity = max_burst * credit_per_byte;
+	m_credit = m_capacity;
+	m_last_us = clock_now_us();
+}
+
+void paced_stream::refill(uint64_t now_us)
+{
+	uint64_t elapsed = now_us - m_last_us;
+	m_last_us = now_us;
+
+	uint64_t missing = m_capacity - m_credit;
+	if (elapsed >= missing / m_rate + 1)
+		m_credit = m_capacity;
+	else
+		m_credit = (std::min)(m_capacity, m_credit + elapsed * m_rate);
+}
+
+void paced_stream::refund(size_t bytes)
+{
+	m_credit = (std::min)(m_capacity, m_credit + bytes * credit_per_byte);
+}
+
+task<size_t> paced_stream::read(uint8_t * buffer, size_t size)
+{
+	return m_stream.read(buffer, size);
+}
+
+task<size_t> paced_stream::write(uint8_t const * buffer, size_t size)
+{
+	if (m_rate == 0 || size == 0)
+		return m_stream.write(buffer, size);
+
+	uint64_t now = clock_now_us();
+	this->refill(now);
+
+	size_t allowed = (size_t)(std::min)((uint64_t)size, m_credit / credit_per_byte);
+	if (allowed == 0)
+	{
+		uint64_t wanted = (std::min)((uint64_t)size * credit_per_byte, m_capacity);
+		uint64_t due = now + (wanted - m_credit + m_rate - 1) / m_rate;
+		return detail::make_deadline_task(due).then([this, buffer, size] {
+			return this->write(buffer, size);
+		});
+	}
+
+	m_credit -= allowed * credit_per_byte;
+	return m_stream.write(buffer, allowed).then([this, allowed](size_t r) -> size_t {
+		this->refund(allowed - r);
+		return r;
+	});
+}
@@ -0,0 +1,47 @@
+#ifndef LIBYB_ASYNC_PACED_STREAM_HPP
+#define LIBYB_ASYNC_PACED_STREAM_HPP
+
+#include "stream.hpp"
+#include "../utils/noncopyable.hpp"
+#include <stdint.h>
+
+namespace yb {
+
+// Limits the rate at which data are written to `s`, e.g. to keep
+// from overrunning a device's small receive FIFO. Writes draw on
+// a token bucket that refills at `bytes_per_second` and holds at most
+// `max_burst` bytes. A write that finds the bucket empty waits until
+// it holds enough for the write or for a full burst, whichever is
+// less; otherwise, it writes what the bucket allows.
+//
+// The waits are deadlines handed to the runner; no timer is created.
+// Reads pass through. A rate of zero turns the pacing off.
+class paced_stream
+	: public stream, noncopyable
+{
+public:
+	paced_stream(stream & s, uint64_t bytes_per_second, size_t max_burst);
+
+	// The bucket starts full.
+	void set_rate(uint64_t bytes_per_second, size_t max_burst);
+
+	task<size_t> read(uint8_t * buffer, size_t size);
+	task<size_t> write(uint8_t const * buffer, size_t size);
+
+private:
+	void refill(uint64_t now_us);
+	void refund(size_t bytes);
+
+	stream & m_stream;
+	uint64_t m_rate;
+	uint64_t m_capacity;
+
+	// Measured in millionths of a byte, so that the bucket
+	// refills by `m_rate` every microsecond.
+	uint64_t m_credit;
+	uint64_t m_last_us;
+};
+
+} // namespace yb
+
+#endif // LIBYB_ASYNC_PACED_STREAM_HPP
@@ -0,0 +1,195 @@
+#include "recording_stream.hpp"
+#include "clock.hpp"
+#include <stdexcept>
+#include <string>
+#include <algorithm>
+using namespace yb;
+
+// The log starts with a signature, followed by records of the form
+//
+//     varint delay_us
+//     varint (size << 2) | kind
+//     uint8_t data[size]
+//
+// Failures record the `task_error` code, or zero if the failure
+// was an exception, followed by the exception's message.
+
+static uint8_t const log_signature[] = { 'y', 'b', 'r', 'c', 1 };
+
+enum record_kind
+{
+	rk_read,
+	rk_write,
+	rk_read_failure,
+	rk_write_failure
+};
+
+static void put_varint(std::vector<uint8_t> & out, uint64_t v)
+{
+	while (v >= 0x80)
+	{
+		out.push_back((uint8_t)(v | 0x80));
+		v >>= 7;
+	}
+	out.push_back((uint8_t)v);
+}
+
+static bool get_varint(buffer_ref & in, uint64_t & v)
+{
+	v = 0;
+	for (int shift = 0; !in.empty() && shift < 64; shift += 7)
+	{
+		uint8_t b = in[0];
+		in += 1;
+		v |= (uint64_t)(b & 0x7f) << shift;
+		if ((b & 0x80) == 0)
+			return true;
+	}
+	return false;
+}
+
+recording_stream::recording_stream(stream & s, std::ostream & log, size_t batch_size)
+	: m_stream(s), m_log(log), m_batch_size(batch_size), m_last_us(clock_now_us())
+{
+	m_log.write(reinterpret_cast<char const *>(log_signature), sizeof log_signature);
+}
+
+recording_stream::~recording_stream()
+{
+	this->flush();
+}
+
+void recording_stream::flush()
+{
+	if (!m_batch.empty())
+		m_log.write(reinterpret_cast<char const *>(m_batch.data()), m_batch.size());
+	m_batch.clear();
+}
+
+void recording_stream::record(int kind, task_result<size_t> & r, uint8_t const * data)
+{
+	uint64_t now = clock_now_us();
+	put_varint(m_batch, now - m_last_us);
+	m_last_us = now;
+
+	if (!r.has_exception())
+	{
+		put_varint(m_batch, ((uint64_t)r.get() << 2) | kind);
+		m_batch.insert(m_batch.end(), data, data + r.get());
+	}
+	else
+	{
+		std::string msg;
+		if (!r.has_error())
+		{
+			try
+			{
+				std::rethrow_exception(r.exception());
+			}
+			catch (std::exception const & e)
+			{
+				msg = e.what();
+			}
+			catch (...)
+			{
+			}
+		}
+
+		put_varint(m_batch, ((uint64_t)(msg.size() + 1) << 2) | (kind + 2));
+		m_batch.push_back(r.has_error()? (uint8_t)r.error(): 0);
+		m_batch.insert(m_batch.end(), msg.begin(), msg.end());
+	}
+
+	if (m_batch.size() >= m_batch_size)
+		this->flush();
+}
+
+task<size_t> recording_stream::read(uint8_t * buffer, size_t size)
+{
+	return m_stream.read(buffer, size).continue_with([this, buffer](task_result<size_t> r) {
+		this->record(rk_read, r, buffer);
+		return async::result(std::move(r));
+	});
+}
+
+task<size_t> recording_stream::write(uint8_t const * buffer, size_t size)
+{
+	return m_stream.write(buffer, size).continue_with([this, buffer](task_result<size_t> r) {
+		this->record(rk_write, r, buffer);
+		return async::result(std::move(r));
+	});
+}
+
+replay_stream::replay_stream(buffer_ref const & log, bool paced)
+	: m_log(log), m_paced(paced), m_started(false), m_start_us(0), m_time_us(0), m_written(0)
+{
+	if (m_log.size() < sizeof log_signature || !std::equal(log_signature, log_signature + sizeof log_signature, m_log.begin()))
+		throw std::runtime_error("not a stream recording");
+	m_log += sizeof log_signature;
+}
+
+task<size_t> replay_stream::read(uint8_t * buffer, size_t size)
+{
+	if (!m_started)
+	{
+		m_start_us = clock_now_us();
+		m_started = true;
+	}
+
+	if (size == 0)
+		return async::value((size_t)0);
+
+	while (m_chunk.empty())
+	{
+		if (m_log.empty())
+			return async::fail<size_t>(te_eof);
+
+		uint64_t delay, header;
+		buffer_ref log = m_log;
+		if (!get_varint(log, delay) || !get_varint(log, header) || (header >> 2) > log.size())
+			return async::raise<size_t>(std::runtime_error("the stream recording is corrupted"));
+
+		int kind = header & 3;
+		buffer_ref data(log.data(), (size_t)(header >> 2));
+		if (kind == rk_read || kind == rk_read_failure)
+		{
+			// Leave the record in place until its time has come.
+			if (m_paced && m_start_us + m_time_us + delay > clock_now_us())
+			{
+				return m_timer.wait_until(m_start_us + m_time_us + delay).then([this, buffer, size] {
+					return this->read(buffer, size);
+				});
+			}
+		}
+
+		m_time_us += delay;
+		m_log = buffer_ref(data.end(), log.end());
+
+		if (kind == rk_read)
+		{
+			m_chunk = data;
+		}
+		else if (kind == rk_read_failure)
+		{
+			if (data.empty())
+				return async::raise<size_t>(std::runtime_error("the stream recording is corrupted"));
+			if (data[0] != 0)
+				return async::fail<size_t>((task_error)data[0]);
+
+			std::string msg(reinterpret_cast<char const *>(data.data()) + 1, data.size() - 1);
+			return async::raise<size_t>(std::runtime_error(msg));
+		}
+	}
+
+	size_t chunk = (std::min)(size, m_chunk.size());
+	std::copy(m_chunk.begin(), m_chunk.begin() + chunk, buffer);
+	m_chunk += chunk;
+	return async::value(chunk);
+}
+
+task<size_t> replay_stream::write(uint8_t const * buffer, size_t size)
+{
+	(void)buffer;
+	m_written += size;
+	return async::value(size);
+}
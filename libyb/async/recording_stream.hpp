@@ -0,0 +1,78 @@
+#ifndef LIBYB_ASYNC_RECORDING_STREAM_HPP
+#define LIBYB_ASYNC_RECORDING_STREAM_HPP
+
+#include "stream.hpp"
+#include "timer.hpp"
+#include "../vector_ref.hpp"
+#include "../utils/noncopyable.hpp"
+#include <ostream>
+#include <vector>
+
+namespace yb {
+
+// Passes everything through to `s` and logs each completed read
+// and write, failures included, to `log`. Every record carries
+// the time since the previous one in microseconds, as measured
+// by `clock_now_us`, so the log can be replayed with the original
+// timing by `replay_stream`.
+//
+// Records are collected in memory and written out in batches
+// of `batch_size` bytes, by `flush` and by the destructor.
+class recording_stream
+	: public stream, noncopyable
+{
+public:
+	recording_stream(stream & s, std::ostream & log, size_t batch_size = 65536);
+	~recording_stream();
+
+	task<size_t> read(uint8_t * buffer, size_t size);
+	task<size_t> write(uint8_t const * buffer, size_t size);
+
+	void flush();
+
+private:
+	void record(int kind, task_result<size_t> & r, uint8_t const * data);
+
+	stream & m_stream;
+	std::ostream & m_log;
+	size_t m_batch_size;
+	std::vector<uint8_t> m_batch;
+	uint64_t m_last_us;
+};
+
+// Plays back a log made by `recording_stream`. Reads return the
+// recorded read data, in chunks no larger than they were recorded
+// in, and the recorded read failures; once the log is exhausted,
+// reads fail with `te_eof`. Writes are accepted and discarded.
+//
+// If `paced`, each read chunk is held back until as much time
+// has passed since the first read as had passed when it was
+// recorded; otherwise the log is played back as fast as possible.
+// The log must outlive the stream; a `mapped_file` works well.
+class replay_stream
+	: public stream, noncopyable
+{
+public:
+	// Throws `std::runtime_error` if `log` isn't a recording.
+	explicit replay_stream(buffer_ref const & log, bool paced = false);
+
+	task<size_t> read(uint8_t * buffer, size_t size);
+	task<size_t> write(uint8_t const * buffer, size_t size);
+
+	// The number of bytes written to the stream so far.
+	uint64_t bytes_written() const { return m_written; }
+
+private:
+	buffer_ref m_log;
+	bool m_paced;
+	bool m_started;
+	uint64_t m_start_us;
+	uint64_t m_time_us;
+	buffer_ref m_chunk;
+	uint64_t m_written;
+	timer m_timer;
+};
+
+} // namespace yb
+
+#endif // LIBYB_ASYNC_RECORDING_STREAM_HPP
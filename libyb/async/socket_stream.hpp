@@ -0,0 +1,83 @@
+#ifndef LIBYB_ASYNC_SOCKET_STREAM_HPP
+#define LIBYB_ASYNC_SOCKET_STREAM_HPP
+
+#include "fd_stream.hpp"
+#include "../vector_ref.hpp"
+#include <memory>
+#include <string>
+#include <stdint.h>
+
+namespace yb {
+
+// A connected Unix-domain or TCP socket.
+class socket_stream
+	: public fd_stream
+{
+public:
+	socket_stream();
+	explicit socket_stream(int fd);
+
+	task<void> connect_unix(yb::string_ref const & path);
+
+	// Connects to an IPv4 `address`, e.g. "127.0.0.1".
+	task<void> connect_tcp(yb::string_ref const & address, uint16_t port);
+};
+
+class socket_acceptor
+	: noncopyable
+{
+public:
+	socket_acceptor();
+	~socket_acceptor();
+
+	// A stale socket file at `path` is replaced; the file
+	// is removed again when the acceptor is closed.
+	void listen_unix(yb::string_ref const & path, int backlog = 64);
+
+	// Listens on an IPv4 `address`; port 0 picks a free port,
+	// which `local_port` then returns.
+	void listen_tcp(yb::string_ref const & address, uint16_t port, int backlog = 64);
+
+	uint16_t local_port() const;
+	void close();
+
+	// Waits for a connection and attaches it to `s`.
+	task<void> accept(socket_stream & s);
+
+private:
+	int m_fd;
+	bool m_tcp;
+	std::string m_unix_path;
+};
+
+// Copies data both ways between `a` and `b` until one of them reaches
+// the end of the stream; the other direction is then cancelled.
+// The end of either stream completes the bridge successfully.
+task<void> bridge(stream & a, stream & b, size_t buffer_size = 64*1024);
+
+// Accepts connections until cancelled and serves each of them
+// concurrently with the task returned by `on_client`, which is passed
+// a `std::shared_ptr<socket_stream>`. A client's failure only ends that
+// client. Cancelling the server stops accepting and forwards
+// the cancel level to the clients.
+template <typename F>
+task<void> serve(socket_acceptor & acceptor, F on_client);
+
+} // namespace yb
+
+#include "detail/server_task.hpp"
+
+template <typename F>
+yb::task<void> yb::serve(socket_acceptor & acceptor, F on_client)
+{
+	try
+	{
+		return task<void>(new detail::server_task<F>(acceptor, std::move(on_client)));
+	}
+	catch (...)
+	{
+		return async::raise<void>();
+	}
+}
+
+#endif // LIBYB_ASYNC_SOCKET_STREAM_HPP
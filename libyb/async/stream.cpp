@@ -1,13 +1,36 @@
 #include "stream.hpp"
+#include "detail/wait_context.hpp"
+#include "../utils/noncopyable.hpp"
+#include <algorithm>
 #include <vector>
 using namespace yb;
 
+task<size_t> stream::readv(read_segment const * segments, size_t count)
+{
+	for (size_t i = 0; i < count; ++i)
+	{
+		if (segments[i].size != 0)
+			return this->read(segments[i].data, segments[i].size);
+	}
+	return async::value((size_t)0);
+}
+
+task<size_t> stream::writev(buffer_ref const * segments, size_t count)
+{
+	for (size_t i = 0; i < count; ++i)
+	{
+		if (!segments[i].empty())
+			return this->write(segments[i].data(), segments[i].size());
+	}
+	return async::value((size_t)0);
+}
+
 task<void> stream::read_all(uint8_t * buffer, size_t size)
 {
 	return loop_with_state<size_t, size_t>(async::value((size_t)0), 0, [this, buffer, size](size_t r, size_t & st, cancel_level cl) -> task<size_t> {
 		st += r;
 		if (cl >= cl_abort)
-			return async::raise<size_t>(task_cancelled(cl));
+			return async::fail<size_t>(te_cancelled);
 		if (st == size)
 			return nulltask;
 		return this->read(buffer + st, size - st);
@@ -19,28 +42,246 @@ task<void> stream::write_all(uint8_t const * buffer, size_t size)
 	return loop_with_state<size_t, size_t>(async::value((size_t)0), 0, [this, buffer, size](size_t r, size_t & st, cancel_level cl) -> task<size_t> {
 		st += r;
 		if (cl >= cl_abort)
-			return async::raise<size_t>(task_cancelled(cl));
+			return async::fail<size_t>(te_cancelled);
 		if (st == size)
 			return nulltask;
 		return this->write(buffer + st, size - st);
 	});
 }
 
-static task<void> copy_iter(std::shared_ptr<std::vector<uint8_t>> const & ctx, stream & sink, stream & source)
+task<void> stream::writev_all(buffer_ref const * segments, size_t count)
 {
-	return source.read(ctx->data(), ctx->size()).abort_on(cl_quit).then([ctx, &sink](size_t r) {
-		return sink.write_all(ctx->data(), r);
-	});
+	try
+	{
+		std::shared_ptr<std::vector<buffer_ref>> ctx(new std::vector<buffer_ref>(segments, segments + count));
+		return loop_with_state<size_t, size_t>(async::value((size_t)0), 0, [this, ctx](size_t r, size_t & first, cancel_level cl) -> task<size_t> {
+			std::vector<buffer_ref> & v = *ctx;
+			for (; first != v.size() && r >= v[first].size(); ++first)
+				r -= v[first].size();
+			if (first != v.size())
+				v[first] += r;
+
+			if (cl >= cl_abort)
+				return async::fail<size_t>(te_cancelled);
+			if (first == v.size())
+				return nulltask;
+			return this->writev(v.data() + first, v.size() - first);
+		});
+	}
+	catch (...)
+	{
+		return async::raise<void>();
+	}
 }
 
-task<void> yb::copy(stream & sink, stream & source, size_t buffer_size)
+namespace {
+
+// Copies through a ring of `depth` buffers: the source is read into
+// the free buffers while the filled ones are written to the sink,
+// so that both streams are busy at the same time. There is at most one
+// read and one write in flight, which keeps the order of the data
+// for streams that don't order concurrent requests.
+class copy_task
+	: public task_base<void>, noncopyable
 {
+public:
+	copy_task(stream & sink, stream & source, size_t buffer_size, size_t depth)
+		: m_sink(sink), m_source(source), m_buffer_size(buffer_size), m_depth(depth),
+		m_buffers(buffer_size * depth), m_sizes(depth), m_read_slot(0), m_write_slot(0), m_filled(0),
+		m_reading(true), m_cl(cl_none)
+	{
+		this->pump(0);
+	}
+
+	void cancel(cancel_level cl) throw()
+	{
+		m_cl = (std::max)(m_cl, cl);
+
+		// Data that were already read are written out on `cl_quit`.
+		if (cl >= cl_quit)
+			m_read.cancel(cl_abort);
+		if (cl >= cl_abort)
+			m_write.cancel(cl);
+	}
+
+	task_result<void> cancel_and_wait() throw()
+	{
+		if (m_read.has_task())
+			m_read.cancel_and_wait();
+		if (m_write.has_task())
+		{
+			task_result<void> r = m_write.cancel_and_wait();
+			if (r.has_exception() && !m_failure.has_exception())
+				m_failure = std::move(r);
+		}
+
+		if (m_failure.has_exception())
+			return m_failure;
+		if (m_filled != 0 || (m_reading && m_cl < cl_quit))
+			return task_result<void>(te_cancelled);
+		return task_result<void>();
+	}
+
+	void prepare_wait(task_wait_preparation_context & ctx)
+	{
+		// Transfers that completed without waiting are picked up
+		// in the next round. With neither in flight, the copy
+		// is over, e.g. because the very first read failed.
+		if (m_read.has_result() || m_write.has_result() || (m_read.empty() && m_write.empty()))
+		{
+			ctx.set_finished();
+			return;
+		}
+
+		if (m_read.has_task())
+		{
+			task_wait_memento_builder mb(ctx);
+			m_read.prepare_wait(ctx);
+			m_read_memento = mb.finish();
+		}
+
+		if (m_write.has_task())
+		{
+			task_wait_memento_builder mb(ctx);
+			m_write.prepare_wait(ctx);
+			m_write_memento = mb.finish();
+		}
+	}
+
+	task<void> finish_wait(task_wait_finalization_context & ctx) throw()
+	{
+		if (m_read.has_task() && ctx.contains(m_read_memento))
+			m_read.finish_wait(ctx);
+		if (m_write.has_task() && ctx.contains(m_write_memento))
+			m_write.finish_wait(ctx);
+
+		this->pump(ctx.prep_ctx);
+
+		if (!m_read.empty() || !m_write.empty())
+			return nulltask;
+		if (!m_failure.has_exception() && m_filled != 0)
+			return async::fail<void>(te_cancelled);
+		return async::result(std::move(m_failure));
+	}
+
+private:
+	uint8_t * buffer(size_t slot)
+	{
+		return m_buffers.data() + slot * m_buffer_size;
+	}
+
+	void pump(task_wait_preparation_context * budget) throw()
+	{
+		for (bool first = true; ; first = false)
+		{
+			bool progress = false;
+
+			if (m_read.has_result())
+			{
+				task_result<size_t> r = m_read.get_result();
+				m_read.clear();
+
+				if (r.has_value())
+				{
+					size_t size = r.get();
+					if (size != 0)
+					{
+						m_sizes[m_read_slot] = size;
+						m_read_slot = (m_read_slot + 1) % m_depth;
+						++m_filled;
+					}
+				}
+				else
+				{
+					// A read that was aborted on `cl_quit` ends the copy
+					// successfully once the buffered data are written.
+					m_reading = false;
+					if (m_cl < cl_quit && !m_failure.has_exception())
+						m_failure = async::fail<void>(r).get_result();
+				}
+			}
+
+			if (m_write.has_result())
+			{
+				task_result<void> r = m_write.get_result();
+				m_write.clear();
+
+				if (r.has_exception())
+				{
+					if (!m_failure.has_exception())
+						m_failure = std::move(r);
+					m_reading = false;
+					m_filled = 0;
+					m_read.cancel(cl_abort);
+				}
+				else
+				{
+					m_write_slot = (m_write_slot + 1) % m_depth;
+					--m_filled;
+				}
+			}
+
+			if (m_write.empty() && m_filled != 0 && m_cl < cl_abort)
+			{
+				m_write = m_sink.write_all(this->buffer(m_write_slot), m_sizes[m_write_slot]);
+				progress = true;
+			}
+
+			if (m_read.empty() && m_reading && m_cl < cl_quit && m_filled != m_depth)
+			{
+				m_read = m_source.read(this->buffer(m_read_slot), m_buffer_size);
+				progress = true;
+			}
+
+			if (!progress || (!m_read.has_result() && !m_write.has_result()))
+				break;
+
+			// Streams that complete without waiting yield
+			// once the budget is used up.
+			if (!first && (!budget || !budget->consume_budget()))
+				break;
+		}
+	}
+
+	stream & m_sink;
+	stream & m_source;
+	size_t m_buffer_size;
+	size_t m_depth;
+
+	std::vector<uint8_t> m_buffers;
+	std::vector<size_t> m_sizes;
+	size_t m_read_slot;
+	size_t m_write_slot;
+	size_t m_filled;
+
+	bool m_reading;
+	cancel_level m_cl;
+	task_result<void> m_failure;
+
+	task<size_t> m_read;
+	task_wait_memento m_read_memento;
+	task<void> m_write;
+	task_wait_memento m_write_memento;
+};
+
+} // namespace
+
+task<void> stream::splice_from(stream & /*source*/, size_t /*buffer_size*/)
+{
+	return task<void>();
+}
+
+task<void> yb::copy(stream & sink, stream & source, size_t buffer_size, size_t depth)
+{
+	assert(buffer_size != 0 && depth != 0);
+
+	task<void> res = sink.splice_from(source, buffer_size);
+	if (!res.empty())
+		return res;
+
 	try
 	{
-		std::shared_ptr<std::vector<uint8_t>> ctx(new std::vector<uint8_t>(buffer_size));
-		return loop([ctx, &sink, &source](cancel_level cl) {
-			return cl >= cl_quit? nulltask: copy_iter(ctx, sink, source);
-		});
+		return task<void>(new copy_task(sink, source, buffer_size, depth));
 	}
 	catch (...)
 	{
@@ -2,21 +2,52 @@
 #define LIBYB_ASYNC_STREAM_HPP
 
 #include "task.hpp"
+#include "../vector_ref.hpp"
 #include <stdint.h>
 
 namespace yb {
 
+// A piece of memory for `stream::readv` to read into.
+struct read_segment
+{
+	uint8_t * data;
+	size_t size;
+};
+
 class stream
 {
 public:
 	virtual task<size_t> read(uint8_t * buffer, size_t size) = 0;
 	virtual task<size_t> write(uint8_t const * buffer, size_t size) = 0;
 
+	// Scatter-gather versions of `read` and `write`. Like them, they may
+	// transfer fewer bytes than requested; the segments are filled
+	// or written in order. The segment array must stay valid until
+	// the task completes. By default, only the first non-empty segment
+	// is transferred.
+	virtual task<size_t> readv(read_segment const * segments, size_t count);
+	virtual task<size_t> writev(buffer_ref const * segments, size_t count);
+
 	task<void> read_all(uint8_t * buffer, size_t size);
 	task<void> write_all(uint8_t const * buffer, size_t size);
+
+	// Unlike `writev`, copies the segment array, which needn't
+	// outlive the call.
+	task<void> writev_all(buffer_ref const * segments, size_t count);
+
+	// Returns a task that moves everything from `source` into this stream
+	// without passing it through user space, as `copy` would, or an empty
+	// task if the pair of streams doesn't allow that. By default, it
+	// doesn't.
+	virtual task<void> splice_from(stream & source, size_t buffer_size);
 };
 
-task<void> copy(stream & sink, stream & source, size_t buffer_size = 256);
+// Moves data from `source` to `sink` until the source fails; the end
+// of the stream is reported as `te_eof`. Up to `depth` buffers of
+// `buffer_size` bytes are kept in flight, so that the source is read
+// while previous data are written. On `cl_quit`, the copy stops
+// reading and completes once the data already read are written.
+task<void> copy(stream & sink, stream & source, size_t buffer_size = 256, size_t depth = 2);
 task<void> discard(stream & source, size_t buffer_size = 256);
 
 } // namespace yb
@@ -0,0 +1,241 @@
+#include "stream_pair.hpp"
+#include "clock.hpp"
+#include "detail/wait_context.hpp"
+#include <algorithm>
+#include <stdexcept>
+#include <cassert>
+using namespace yb;
+
+// Completes once `ready` holds. The pipe registers nothing to wait on;
+// the other end's progress is seen when the runner prepares the task
+// next. Only the delivery of delayed data is waited for.
+class stream_pair::wait_task
+	: public task_base<void>
+{
+public:
+	wait_task(pipe & p, bool (pipe::*ready)() const)
+		: m_pipe(p), m_ready(ready), m_cancelled(false)
+	{
+	}
+
+	void cancel(cancel_level cl) throw()
+	{
+		if (cl >= cl_abort)
+			m_cancelled = true;
+	}
+
+	task_result<void> cancel_and_wait() throw()
+	{
+		if ((m_pipe.*m_ready)())
+			return task_result<void>();
+		return task_result<void>(te_cancelled);
+	}
+
+	void prepare_wait(task_wait_preparation_context & ctx)
+	{
+		if (m_cancelled || (m_pipe.*m_ready)())
+		{
+			ctx.set_finished();
+			return;
+		}
+
+		uint64_t due = m_pipe.next_delivery_us();
+		if (due != task_wait_preparation_context::no_deadline)
+			ctx.add_deadline(due);
+	}
+
+	task<void> finish_wait(task_wait_finalization_context &) throw()
+	{
+		if (m_cancelled)
+			return async::fail<void>(te_cancelled);
+		if ((m_pipe.*m_ready)())
+			return async::value();
+		return nulltask;
+	}
+
+private:
+	pipe & m_pipe;
+	bool (pipe::*m_ready)() const;
+	bool m_cancelled;
+};
+
+stream_pair::pipe::pipe(size_t capacity, size_t max_chunks)
+	: m_data(capacity), m_pushed(0), m_popped(0), m_delivered(0),
+	m_marks(max_chunks), m_first_mark(0), m_mark_count(0),
+	m_latency_us(0), m_bytes_per_second(0), m_link_free_us(0), m_shut_down(false)
+{
+	assert(capacity != 0 && max_chunks != 0);
+}
+
+void stream_pair::pipe::set_link(uint64_t latency_us, uint64_t bytes_per_second)
+{
+	m_latency_us = latency_us;
+	m_bytes_per_second = bytes_per_second;
+}
+
+uint64_t stream_pair::pipe::deliverable_end() const
+{
+	if (m_mark_count == 0)
+		return m_pushed;
+
+	uint64_t now = clock_now_us();
+	uint64_t res = m_delivered;
+	for (size_t i = 0; i < m_mark_count; ++i)
+	{
+		mark const & m = m_marks[(m_first_mark + i) % m_marks.size()];
+		if (m.ready_us > now)
+			break;
+		res = m.end;
+	}
+	return res;
+}
+
+uint64_t stream_pair::pipe::next_delivery_us() const
+{
+	uint64_t now = clock_now_us();
+	for (size_t i = 0; i < m_mark_count; ++i)
+	{
+		mark const & m = m_marks[(m_first_mark + i) % m_marks.size()];
+		if (m.ready_us > now)
+			return m.ready_us;
+	}
+	return task_wait_preparation_context::no_deadline;
+}
+
+bool stream_pair::pipe::readable() const
+{
+	return this->deliverable_end() != m_popped || (m_shut_down && m_pushed == m_popped);
+}
+
+bool stream_pair::pipe::writable() const
+{
+	if (m_pushed - m_popped == m_data.size())
+		return false;
+	bool shaped = m_latency_us != 0 || m_bytes_per_second != 0;
+	return !shaped || m_mark_count != m_marks.size();
+}
+
+size_t stream_pair::pipe::push(uint8_t const * buffer, size_t size)
+{
+	if (!this->writable())
+		return 0;
+
+	size_t res = (std::min)(size, m_data.size() - (size_t)(m_pushed - m_popped));
+	size_t pos = (size_t)(m_pushed % m_data.size());
+	size_t chunk = (std::min)(res, m_data.size() - pos);
+	std::copy(buffer, buffer + chunk, m_data.data() + pos);
+	std::copy(buffer + chunk, buffer + res, m_data.data());
+
+	if (m_latency_us != 0 || m_bytes_per_second != 0)
+	{
+		uint64_t start = (std::max)(clock_now_us(), m_link_free_us);
+		if (m_bytes_per_second != 0)
+			start += (res * (uint64_t)1000000 + m_bytes_per_second - 1) / m_bytes_per_second;
+		m_link_free_us = start;
+
+		uint64_t ready = start + m_latency_us;
+		mark * last = m_mark_count? &m_marks[(m_first_mark + m_mark_count - 1) % m_marks.size()]: 0;
+		if (last && last->ready_us == ready)
+		{
+			last->end = m_pushed + res;
+		}
+		else
+		{
+			if (m_mark_count == 0)
+				m_delivered = m_pushed;
+
+			mark & m = m_marks[(m_first_mark + m_mark_count++) % m_marks.size()];
+			m.end = m_pushed + res;
+			m.ready_us = ready;
+		}
+	}
+	else if (m_mark_count != 0)
+	{
+		// Data can't overtake the delayed data before them.
+		m_marks[(m_first_mark + m_mark_count - 1) % m_marks.size()].end = m_pushed + res;
+	}
+
+	m_pushed += res;
+	return res;
+}
+
+size_t stream_pair::pipe::pop(uint8_t * buffer, size_t size)
+{
+	size_t res = (size_t)(std::min)((uint64_t)size, this->deliverable_end() - m_popped);
+	size_t pos = (size_t)(m_popped % m_data.size());
+	size_t chunk = (std::min)(res, m_data.size() - pos);
+	std::copy(m_data.data() + pos, m_data.data() + pos + chunk, buffer);
+	std::copy(m_data.data(), m_data.data() + (res - chunk), buffer + chunk);
+	m_popped += res;
+
+	while (m_mark_count != 0 && m_marks[m_first_mark].end <= m_popped)
+	{
+		m_delivered = m_marks[m_first_mark].end;
+		m_first_mark = (m_first_mark + 1) % m_marks.size();
+		--m_mark_count;
+	}
+
+	return res;
+}
+
+stream_pair::end::end()
+	: m_in(0), m_out(0)
+{
+}
+
+task<size_t> stream_pair::end::read(uint8_t * buffer, size_t size)
+{
+	if (size == 0)
+		return async::value((size_t)0);
+
+	size_t r = m_in->pop(buffer, size);
+	if (r != 0)
+		return async::value(r);
+
+	if (m_in->shut_down() && m_in->readable())
+		return async::fail<size_t>(te_eof);
+
+	return protect([this] {
+		return task<void>(new wait_task(*m_in, &pipe::readable));
+	}).then([this, buffer, size] {
+		return this->read(buffer, size);
+	});
+}
+
+task<size_t> stream_pair::end::write(uint8_t const * buffer, size_t size)
+{
+	if (m_out->shut_down())
+		return async::raise<size_t>(std::logic_error("write to a shut down stream"));
+
+	if (size == 0)
+		return async::value((size_t)0);
+
+	size_t r = m_out->push(buffer, size);
+	if (r != 0)
+		return async::value(r);
+
+	return protect([this] {
+		return task<void>(new wait_task(*m_out, &pipe::writable));
+	}).then([this, buffer, size] {
+		return this->write(buffer, size);
+	});
+}
+
+void stream_pair::end::set_link(uint64_t latency_us, uint64_t bytes_per_second)
+{
+	m_out->set_link(latency_us, bytes_per_second);
+}
+
+void stream_pair::end::shutdown_write()
+{
+	m_out->shutdown();
+}
+
+stream_pair::stream_pair(size_t capacity, size_t max_chunks)
+	: m_first_to_second(capacity, max_chunks), m_second_to_first(capacity, max_chunks)
+{
+	m_first.m_out = &m_first_to_second;
+	m_first.m_in = &m_second_to_first;
+	m_second.m_out = &m_second_to_first;
+	m_second.m_in = &m_first_to_second;
+}
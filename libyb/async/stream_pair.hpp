@@ -0,0 +1,111 @@
+#ifndef LIBYB_ASYNC_STREAM_PAIR_HPP
+#define LIBYB_ASYNC_STREAM_PAIR_HPP
+
+#include "stream.hpp"
+#include "../utils/noncopyable.hpp"
+#include <vector>
+#include <stdint.h>
+
+namespace yb {
+
+// Two streams connected back to back in memory; whatever is written
+// to one end is read from the other. Each direction has a ring buffer
+// of `capacity` bytes. Writes complete as soon as there is room in the
+// ring, reads as soon as there are data in it, and they only wait
+// otherwise. Transfers that don't wait allocate nothing.
+//
+// A waiting end notices the progress of the other end when its runner
+// prepares it next, so both ends must be run by the same runner.
+class stream_pair
+	: noncopyable
+{
+private:
+	class pipe;
+
+public:
+	class end
+		: public stream, noncopyable
+	{
+	public:
+		task<size_t> read(uint8_t * buffer, size_t size);
+		task<size_t> write(uint8_t const * buffer, size_t size);
+
+		// Data written to this end reach the other one `latency_us`
+		// after they were written, and if `bytes_per_second` is nonzero,
+		// they are sent no faster than that. Initially, the link
+		// delivers data right away.
+		void set_link(uint64_t latency_us, uint64_t bytes_per_second = 0);
+
+		// Once the data already written have been read, reads
+		// on the other end fail with `te_eof`.
+		void shutdown_write();
+
+	private:
+		end();
+
+		pipe * m_in;
+		pipe * m_out;
+
+		friend class stream_pair;
+	};
+
+	// Up to `max_chunks` writes per direction may be in transit
+	// on a slowed-down link before further writes wait.
+	explicit stream_pair(size_t capacity = 4096, size_t max_chunks = 64);
+
+	end & first() { return m_first; }
+	end & second() { return m_second; }
+
+private:
+	class pipe
+		: noncopyable
+	{
+	public:
+		pipe(size_t capacity, size_t max_chunks);
+
+		void set_link(uint64_t latency_us, uint64_t bytes_per_second);
+		void shutdown() { m_shut_down = true; }
+		bool shut_down() const { return m_shut_down; }
+
+		size_t push(uint8_t const * buffer, size_t size);
+		size_t pop(uint8_t * buffer, size_t size);
+
+		bool readable() const;
+		bool writable() const;
+		uint64_t next_delivery_us() const;
+
+	private:
+		struct mark
+		{
+			uint64_t end;
+			uint64_t ready_us;
+		};
+
+		uint64_t deliverable_end() const;
+
+		std::vector<uint8_t> m_data;
+		uint64_t m_pushed;
+		uint64_t m_popped;
+		uint64_t m_delivered;
+
+		std::vector<mark> m_marks;
+		size_t m_first_mark;
+		size_t m_mark_count;
+
+		uint64_t m_latency_us;
+		uint64_t m_bytes_per_second;
+		uint64_t m_link_free_us;
+		bool m_shut_down;
+	};
+
+	class wait_task;
+
+	pipe m_first_to_second;
+	pipe m_second_to_first;
+	end m_first;
+	end m_second;
+};
+
+} // namespace yb
+
+#endif // LIBYB_ASYNC_STREAM_PAIR_HPP
@@ -158,10 +158,22 @@ private:
 class sync_runner
 {
 public:
+	sync_runner()
+		: m_work_budget(task_wait_preparation_context::default_budget), m_poll_due(false)
+	{
+	}
+
 	~sync_runner()
 	{
 	}
 
+	// Sets the number of synchronous steps tasks may take in one round
+	// before they yield; see `task_wait_preparation_context::set_budget`.
+	void set_work_budget(size_t steps)
+	{
+		m_work_budget = steps;
+	}
+
 	template <typename T>
 	sync_future<T> post(task<T> && t)
 	{
@@ -302,6 +314,11 @@ private:
 	};
 
 	task<void> m_parallel_tasks;
+	size_t m_work_budget;
+
+	// Set after a round that only finished ready tasks; the next round
+	// polls for I/O even if some tasks are ready again.
+	bool m_poll_due;
 };
 
 template <typename T>
@@ -27,6 +27,10 @@ public:
 	// and synchronously waits for it to complete.
 	virtual task_result<R> cancel_and_wait() throw() = 0;
 
+	// May be called several times before the matching `finish_wait`;
+	// a task that doesn't report itself finished must be ready
+	// to be prepared again with the same outcome. While the context
+	// is `probing`, nothing that isn't part of finishing may change.
 	virtual void prepare_wait(task_wait_preparation_context & ctx) = 0;
 
 	// An empty task indicates a stall.
@@ -0,0 +1,83 @@
+#ifndef LIBYB_ASYNC_TASK_ERROR_HPP
+#define LIBYB_ASYNC_TASK_ERROR_HPP
+
+#include "cancel_exception.hpp"
+#include <exception>
+
+namespace yb {
+
+// Failures common enough on I/O paths that a `task_result` carries them
+// as a plain code. An exception object is only created when someone asks
+// for one through `task_result::exception` or `task_result::get`.
+enum task_error
+{
+	te_cancelled = 1,
+	te_timeout,
+	te_eof,
+	te_device_gone
+};
+
+char const * task_error_message(task_error e) throw();
+
+// Thrown when a result carrying a `task_error` other than `te_cancelled`
+// is rethrown; `te_cancelled` is rethrown as `task_cancelled`.
+class task_error_exception
+	: public std::exception
+{
+public:
+	explicit task_error_exception(task_error e)
+		: m_error(e)
+	{
+	}
+
+	task_error error() const throw()
+	{
+		return m_error;
+	}
+
+	const char * what() const throw()
+	{
+		return task_error_message(m_error);
+	}
+
+private:
+	task_error m_error;
+};
+
+std::exception_ptr make_task_error_exception(task_error e);
+void throw_task_error(task_error e);
+
+} // namespace yb
+
+inline char const * yb::task_error_message(task_error e) throw()
+{
+	switch (e)
+	{
+	case te_cancelled:
+		return "cancelled";
+	case te_timeout:
+		return "timed out";
+	case te_eof:
+		return "end of stream";
+	case te_device_gone:
+		return "device disconnected";
+	}
+
+	return "unknown task error";
+}
+
+inline std::exception_ptr yb::make_task_error_exception(task_error e)
+{
+	if (e == te_cancelled)
+		return std::make_exception_ptr(task_cancelled());
+	return std::make_exception_ptr(task_error_exception(e));
+}
+
+inline void yb::throw_task_error(task_error e)
+{
+	if (e == te_cancelled)
+		throw task_cancelled();
+	throw task_error_exception(e);
+}
+
+#endif // LIBYB_ASYNC_TASK_ERROR_HPP
@@ -5,6 +5,7 @@
 #include <type_traits> // aligned_storage, alignment_of
 
 #include "detail/task_result.hpp"
+#include "task_error.hpp"
 
 namespace yb {
 
@@ -17,6 +18,7 @@ public:
 	task_result(value_type const & v) throw();
 	task_result(value_type && v) throw();
 	task_result(std::exception_ptr e) throw();
+	task_result(task_error e) throw();
 
 	task_result(task_result const & o) throw();
 	task_result(task_result && o) throw();
@@ -25,20 +27,36 @@ public:
 	task_result & operator=(task_result && o);
 
 	bool has_value() const throw();
+
+	// True if the result holds either an exception or an error code.
 	bool has_exception() const throw();
 
+	// True if the result holds an error code; `error()` returns it.
+	bool has_error() const throw();
+	task_error error() const throw();
+
 	value_type get();
+
+	// Returns the stored exception, creating one for an error code.
 	std::exception_ptr exception() const throw();
 
 	void rethrow();
 
 private:
+	enum kind_t { k_value, k_exception, k_error };
+
 	T & as_value() { return reinterpret_cast<T &>(m_storage); }
 	T const & as_value() const { return reinterpret_cast<T const &>(m_storage); }
 	std::exception_ptr & as_exception() { return reinterpret_cast<std::exception_ptr &>(m_storage); }
 	std::exception_ptr const & as_exception() const { return reinterpret_cast<std::exception_ptr const &>(m_storage); }
+	task_error & as_error() { return reinterpret_cast<task_error &>(m_storage); }
+	task_error const & as_error() const { return reinterpret_cast<task_error const &>(m_storage); }
+
+	void construct(task_result const & o) throw();
+	void construct(task_result && o) throw();
+	void destroy() throw();
 
-	bool m_has_value;
+	kind_t m_kind;
 	typename std::aligned_storage<
 		detail::yb_max<sizeof(T), sizeof(std::exception_ptr)>::value,
 		detail::yb_lcm<
@@ -58,6 +76,7 @@ public:
 
 	task_result() throw();
 	task_result(std::exception_ptr e) throw();
+	task_result(task_error e) throw();
 
 	task_result(task_result const & o) throw();
 	task_result(task_result && o) throw();
@@ -67,6 +86,9 @@ public:
 	bool has_value() const throw();
 	bool has_exception() const throw();
 
+	bool has_error() const throw();
+	task_error error() const throw();
+
 	void get();
 	std::exception_ptr exception() const throw();
 
@@ -74,10 +96,17 @@ public:
 
 private:
 	std::exception_ptr m_exception;
+	int m_error;
 
 	task_result & operator=(task_result const & o);
 };
 
+// Returns a failed result of type `T` holding the same error code
+// or exception as `r`, which must have failed. Error codes are passed
+// along without materializing an exception.
+template <typename T, typename S>
+task_result<T> failed_result(task_result<S> const & r) throw();
+
 } // namespace yb
 
 #include <utility> //move
@@ -88,14 +117,22 @@ namespace yb {
 
 template <typename T>
 task_result<T>::task_result(value_type const & v) throw()
-	: m_has_value(true)
+	: m_kind(k_value)
 {
-	new(&m_storage) value_type(v);
+	try
+	{
+		new(&m_storage) value_type(v);
+	}
+	catch (...)
+	{
+		m_kind = k_exception;
+		new(&m_storage) std::exception_ptr(std::current_exception());
+	}
 }
 
 template <typename T>
 task_result<T>::task_result(value_type && v) throw()
-	: m_has_value(true)
+	: m_kind(k_value)
 {
 	try
 	{
@@ -103,80 +140,121 @@ task_result<T>::task_result(value_type && v) throw()
 	}
 	catch (...)
 	{
-		m_has_value = false;
+		m_kind = k_exception;
 		new(&m_storage) std::exception_ptr(std::current_exception());
 	}
 }
 
 template <typename T>
 task_result<T>::task_result(std::exception_ptr e) throw()
-	: m_has_value(false)
+	: m_kind(k_exception)
 {
 	assert(!(e == nullptr));
 	new(&m_storage) std::exception_ptr(std::move(e));
 }
 
+template <typename T>
+task_result<T>::task_result(task_error e) throw()
+	: m_kind(k_error)
+{
+	new(&m_storage) task_error(e);
+}
+
 template <typename T>
 task_result<T>::task_result(task_result const & o) throw()
-	: m_has_value(o.m_has_value)
 {
-	if (m_has_value)
+	this->construct(o);
+}
+
+template <typename T>
+task_result<T>::task_result(task_result && o) throw()
+{
+	this->construct(std::move(o));
+}
+
+template <typename T>
+task_result<T>::~task_result() throw()
+{
+	this->destroy();
+}
+
+template <typename T>
+void task_result<T>::construct(task_result const & o) throw()
+{
+	m_kind = o.m_kind;
+	switch (m_kind)
 	{
+	case k_value:
 		try
 		{
 			new(&m_storage) value_type(o.as_value());
 		}
 		catch (...)
 		{
-			m_has_value = false;
+			m_kind = k_exception;
 			new(&m_storage) std::exception_ptr(std::current_exception());
 		}
-	}
-	else
-	{
+		break;
+	case k_exception:
 		new(&m_storage) std::exception_ptr(o.as_exception());
+		break;
+	case k_error:
+		new(&m_storage) task_error(o.as_error());
+		break;
 	}
 }
 
 template <typename T>
-task_result<T>::task_result(task_result && o) throw()
-	: m_has_value(o.m_has_value)
+void task_result<T>::construct(task_result && o) throw()
 {
-	if (m_has_value)
+	m_kind = o.m_kind;
+	switch (m_kind)
 	{
+	case k_value:
 		try
 		{
 			new(&m_storage) value_type(std::move(o.as_value()));
 		}
 		catch (...)
 		{
-			m_has_value = false;
+			m_kind = k_exception;
 			new(&m_storage) std::exception_ptr(std::current_exception());
 		}
-	}
-	else
-	{
+		break;
+	case k_exception:
 		new(&m_storage) std::exception_ptr(std::move(o.as_exception()));
+		break;
+	case k_error:
+		new(&m_storage) task_error(o.as_error());
+		break;
 	}
 }
 
 template <typename T>
-task_result<T>::~task_result() throw()
+void task_result<T>::destroy() throw()
 {
 	using std::exception_ptr;
 
-	if (m_has_value)
+	switch (m_kind)
+	{
+	case k_value:
 		this->as_value().~value_type();
-	else
+		break;
+	case k_exception:
 		this->as_exception().~exception_ptr();
+		break;
+	case k_error:
+		break;
+	}
 }
 
 template <typename T>
 task_result<T> & task_result<T>::operator=(task_result<T> && o)
 {
-	using std::exception_ptr;
+	if (this == &o)
+		return *this;
 
-	if (m_has_value && o.m_has_value)
+	if (m_kind == k_value && o.m_kind == k_value)
 	{
 		try
 		{
@@ -184,33 +262,15 @@ task_result<T> & task_result<T>::operator=(task_result<T> && o)
 		}
 		catch (...)
 		{
-			this->as_value().~value_type();
-			m_has_value = false;
+			this->destroy();
+			m_kind = k_exception;
 			new(&m_storage) std::exception_ptr(std::current_exception());
 		}
 	}
-	else if (!m_has_value && !o.m_has_value)
-	{
-		this->as_exception() = std::move(o.as_exception());
-	}
-	else if (m_has_value)
-	{
-		this->as_value().~value_type();
-		m_has_value = false;
-		new(&m_storage) std::exception_ptr(std::move(o.as_exception()));
-	}
 	else
 	{
-		this->as_exception().~exception_ptr();
-		try
-		{
-			new(&m_storage) value_type(std::move(o.as_value()));
-			m_has_value = true;
-		}
-		catch (...)
-		{
-			new(&m_storage) std::exception_ptr(std::current_exception());
-		}
+		this->destroy();
+		this->construct(std::move(o));
 	}
 
 	return *this;
@@ -219,13 +279,26 @@ task_result<T> & task_result<T>::operator=(task_result<T> && o)
 template <typename T>
 bool task_result<T>::has_value() const throw()
 {
-	return m_has_value;
+	return m_kind == k_value;
 }
 
 template <typename T>
 bool task_result<T>::has_exception() const throw()
 {
-	return !m_has_value;
+	return m_kind != k_value;
+}
+
+template <typename T>
+bool task_result<T>::has_error() const throw()
+{
+	return m_kind == k_error;
+}
+
+template <typename T>
+task_error task_result<T>::error() const throw()
+{
+	assert(m_kind == k_error);
+	return this->as_error();
 }
 
 template <typename T>
@@ -238,54 +311,83 @@ T task_result<T>::get()
 template <typename T>
 std::exception_ptr task_result<T>::exception() const throw()
 {
-	return this->as_exception();
+	switch (m_kind)
+	{
+	case k_exception:
+		return this->as_exception();
+	case k_error:
+		return make_task_error_exception(this->as_error());
+	default:
+		return std::exception_ptr();
+	}
 }
 
 template <typename T>
 void task_result<T>::rethrow()
 {
-	if (!m_has_value)
+	if (m_kind == k_exception)
 		std::rethrow_exception(this->as_exception());
+	if (m_kind == k_error)
+		throw_task_error(this->as_error());
 }
 
 inline task_result<void>::task_result() throw()
-	: m_exception()
+	: m_exception(), m_error(0)
 {
 }
 
 inline task_result<void>::task_result(std::exception_ptr e) throw()
-	: m_exception(std::move(e))
+	: m_exception(std::move(e)), m_error(0)
+{
+}
+
+inline task_result<void>::task_result(task_error e) throw()
+	: m_exception(), m_error(e)
 {
 }
 
 inline task_result<void>::task_result(task_result const & o) throw()
-	: m_exception(o.m_exception)
+	: m_exception(o.m_exception), m_error(o.m_error)
 {
 }
 
 inline task_result<void>::task_result(task_result && o) throw()
-	: m_exception(std::move(o.m_exception))
+	: m_exception(std::move(o.m_exception)), m_error(o.m_error)
 {
 }
 
 inline task_result<void> & task_result<void>::operator=(task_result<void> && o)
 {
 	m_exception = std::move(o.m_exception);
+	m_error = o.m_error;
 	return *this;
 }
 
 inline bool task_result<void>::has_value() const throw()
 {
-	return m_exception == nullptr;
+	return m_error == 0 && m_exception == nullptr;
 }
 
 inline bool task_result<void>::has_exception() const throw()
 {
-	return !(m_exception == nullptr);
+	return !this->has_value();
+}
+
+inline bool task_result<void>::has_error() const throw()
+{
+	return m_error != 0;
+}
+
+inline task_error task_result<void>::error() const throw()
+{
+	assert(m_error != 0);
+	return static_cast<task_error>(m_error);
 }
 
 inline std::exception_ptr task_result<void>::exception() const throw()
 {
+	if (m_error != 0)
+		return make_task_error_exception(static_cast<task_error>(m_error));
 	return this->m_exception;
 }
 
@@ -296,10 +398,21 @@ inline void task_result<void>::get()
 
 inline void task_result<void>::rethrow()
 {
+	if (m_error != 0)
+		throw_task_error(static_cast<task_error>(m_error));
 	if (!(this->m_exception == nullptr))
 		std::rethrow_exception(this->m_exception);
 }
 
+template <typename T, typename S>
+task_result<T> failed_result(task_result<S> const & r) throw()
+{
+	assert(r.has_exception());
+	if (r.has_error())
+		return task_result<T>(r.error());
+	return task_result<T>(r.exception());
+}
+
 }
 
 #endif // LIBYB_ASYNC_TASK_RESULT_HPP
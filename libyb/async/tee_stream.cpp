@@ -0,0 +1,274 @@
+#include "tee_stream.hpp"
+#include "detail/wait_context.hpp"
+#include <cassert>
+using namespace yb;
+
+struct tee_stream::sink
+{
+	stream * s;
+	tee_policy policy;
+	size_t sample_every;
+	size_t chunk_count;
+	std::vector<uint8_t> staging;
+	task<void> pending;
+	task_wait_memento memento;
+	uint64_t dropped;
+	bool failed;
+};
+
+// Waits for a pending read of the underlying stream and for the sinks
+// it was delivered to, driving the background writes of the other
+// sinks meanwhile. Without a read, waits for all sinks to go idle.
+class tee_stream::drive_task
+	: public task_base<size_t>
+{
+public:
+	drive_task(tee_stream & tee, task<size_t> && read, uint8_t * buffer, bool flush)
+		: m_tee(tee), m_read(std::move(read)), m_buffer(buffer), m_flush(flush), m_result((size_t)0)
+	{
+		// A completed read has already been delivered.
+		if (m_read.has_result())
+		{
+			m_result = m_read.get_result();
+			m_read.clear();
+		}
+	}
+
+	void cancel(cancel_level cl) throw()
+	{
+		if (m_read.has_task())
+			m_read.cancel(cl);
+
+		for (size_t i = 0; i < m_tee.m_sinks.size(); ++i)
+		{
+			sink & s = *m_tee.m_sinks[i];
+			if (s.pending.has_task() && (m_flush || s.policy == tp_block))
+				s.pending.cancel(cl);
+		}
+	}
+
+	task_result<size_t> cancel_and_wait() throw()
+	{
+		if (m_read.has_task())
+		{
+			m_result = m_read.cancel_and_wait();
+			if (!m_result.has_exception())
+				m_tee.deliver(m_buffer, m_result.get());
+		}
+
+		for (size_t i = 0; i < m_tee.m_sinks.size(); ++i)
+		{
+			sink & s = *m_tee.m_sinks[i];
+			if (s.pending.has_task() && (m_flush || s.policy == tp_block))
+			{
+				s.pending = async::result(s.pending.cancel_and_wait());
+				m_tee.collect(s);
+			}
+		}
+
+		return std::move(m_result);
+	}
+
+	void prepare_wait(task_wait_preparation_context & ctx)
+	{
+		if (this->done())
+		{
+			ctx.set_finished();
+			return;
+		}
+
+		if (m_read.has_task())
+		{
+			task_wait_memento_builder mb(ctx);
+			m_read.prepare_wait(ctx);
+			m_read_memento = mb.finish();
+		}
+
+		for (size_t i = 0; i < m_tee.m_sinks.size(); ++i)
+		{
+			sink & s = *m_tee.m_sinks[i];
+			if (s.pending.has_task())
+			{
+				task_wait_memento_builder mb(ctx);
+				s.pending.prepare_wait(ctx);
+				s.memento = mb.finish();
+			}
+		}
+	}
+
+	task<size_t> finish_wait(task_wait_finalization_context & ctx) throw()
+	{
+		// The sinks go first; a delivery below starts writes
+		// that weren't part of this wait.
+		for (size_t i = 0; i < m_tee.m_sinks.size(); ++i)
+		{
+			sink & s = *m_tee.m_sinks[i];
+			if (s.pending.has_task() && ctx.contains(s.memento))
+			{
+				s.pending.finish_wait(ctx);
+				if (s.pending.has_result())
+					m_tee.collect(s);
+			}
+		}
+
+		if (m_read.has_task() && ctx.contains(m_read_memento))
+		{
+			m_read.finish_wait(ctx);
+			if (m_read.has_result())
+			{
+				m_result = m_read.get_result();
+				m_read.clear();
+				if (!m_result.has_exception())
+					m_tee.deliver(m_buffer, m_result.get());
+			}
+		}
+
+		if (this->done())
+			return async::result(std::move(m_result));
+		return nulltask;
+	}
+
+private:
+	bool done() const
+	{
+		return !m_read.has_task() && (m_flush? m_tee.idle(): !m_tee.blocked());
+	}
+
+	tee_stream & m_tee;
+	task<size_t> m_read;
+	task_wait_memento m_read_memento;
+	uint8_t * m_buffer;
+	bool m_flush;
+	task_result<size_t> m_result;
+};
+
+tee_stream::tee_stream(stream & s)
+	: m_stream(s)
+{
+}
+
+tee_stream::~tee_stream()
+{
+	// The background writes refer to the staging buffers.
+	for (size_t i = 0; i < m_sinks.size(); ++i)
+		m_sinks[i]->pending.clear();
+}
+
+size_t tee_stream::add_sink(stream & sink, tee_policy policy, size_t sample_every)
+{
+	assert(sample_every != 0);
+
+	std::unique_ptr<tee_stream::sink> s(new tee_stream::sink());
+	s->s = &sink;
+	s->policy = policy;
+	s->sample_every = policy == tp_sample? sample_every: 1;
+	s->chunk_count = 0;
+	s->dropped = 0;
+	s->failed = false;
+	m_sinks.push_back(std::move(s));
+	return m_sinks.size() - 1;
+}
+
+bool tee_stream::sink_failed(size_t sink) const
+{
+	return m_sinks[sink]->failed;
+}
+
+uint64_t tee_stream::dropped_bytes(size_t sink) const
+{
+	return m_sinks[sink]->dropped;
+}
+
+void tee_stream::deliver(uint8_t const * buffer, size_t size)
+{
+	if (size == 0)
+		return;
+
+	for (size_t i = 0; i < m_sinks.size(); ++i)
+	{
+		sink & s = *m_sinks[i];
+		if (s.failed || s.chunk_count++ % s.sample_every != 0)
+			continue;
+
+		if (!s.pending.empty())
+		{
+			assert(s.policy != tp_block);
+			s.dropped += size;
+			continue;
+		}
+
+		if (s.policy == tp_block)
+		{
+			s.pending = s.s->write_all(buffer, size);
+		}
+		else
+		{
+			s.staging.assign(buffer, buffer + size);
+			s.pending = s.s->write_all(s.staging.data(), size);
+		}
+
+		if (s.pending.has_result())
+			this->collect(s);
+	}
+}
+
+void tee_stream::collect(sink & s)
+{
+	task_result<void> r = s.pending.get_result();
+	s.pending.clear();
+	if (r.has_exception())
+		s.failed = true;
+}
+
+bool tee_stream::blocked() const
+{
+	for (size_t i = 0; i < m_sinks.size(); ++i)
+	{
+		if (m_sinks[i]->policy == tp_block && m_sinks[i]->pending.has_task())
+			return true;
+	}
+	return false;
+}
+
+bool tee_stream::idle() const
+{
+	for (size_t i = 0; i < m_sinks.size(); ++i)
+	{
+		if (m_sinks[i]->pending.has_task())
+			return false;
+	}
+	return true;
+}
+
+task<size_t> tee_stream::read(uint8_t * buffer, size_t size)
+{
+	task<size_t> r = m_stream.read(buffer, size);
+	if (r.has_result())
+	{
+		task_result<size_t> res = r.get_result();
+		if (!res.has_exception())
+			this->deliver(buffer, res.get());
+		if (!this->blocked())
+			return async::result(std::move(res));
+		r = async::result(std::move(res));
+	}
+
+	return protect([this, &r, buffer] {
+		return task<size_t>(new drive_task(*this, std::move(r), buffer, false));
+	});
+}
+
+task<size_t> tee_stream::write(uint8_t const * buffer, size_t size)
+{
+	return m_stream.write(buffer, size);
+}
+
+task<void> tee_stream::flush()
+{
+	if (this->idle())
+		return async::value();
+
+	return protect([this] {
+		return task<size_t>(new drive_task(*this, task<size_t>(), 0, true));
+	}).then([](size_t) {});
+}
@@ -0,0 +1,69 @@
+#ifndef LIBYB_ASYNC_TEE_STREAM_HPP
+#define LIBYB_ASYNC_TEE_STREAM_HPP
+
+#include "stream.hpp"
+#include "../utils/noncopyable.hpp"
+#include <vector>
+#include <memory>
+#include <stdint.h>
+
+namespace yb {
+
+enum tee_policy
+{
+	// The read completes once the sink has written the data.
+	tp_block,
+
+	// The sink gets a copy of the data and writes it in the background;
+	// data read while the sink is still busy are dropped.
+	tp_drop,
+
+	// As `tp_drop`, but only every n-th chunk is offered to the sink.
+	tp_sample
+};
+
+// Passes reads through to `s` and writes every chunk read to a number
+// of sinks as well, e.g. to capture the traffic while it's parsed.
+// Writes go straight to `s` and aren't seen by the sinks.
+//
+// Blocking sinks are handed the reader's buffer itself. Background
+// writes of the other sinks are driven by the pending reads and
+// by `flush`. A sink that fails is detached from the stream.
+// One call may be pending at a time.
+class tee_stream
+	: public stream, noncopyable
+{
+public:
+	explicit tee_stream(stream & s);
+	~tee_stream();
+
+	// Returns the index of the sink. With `tp_sample`, the sink
+	// gets one in every `sample_every` chunks.
+	size_t add_sink(stream & sink, tee_policy policy = tp_block, size_t sample_every = 16);
+
+	bool sink_failed(size_t sink) const;
+	uint64_t dropped_bytes(size_t sink) const;
+
+	task<size_t> read(uint8_t * buffer, size_t size);
+	task<size_t> write(uint8_t const * buffer, size_t size);
+
+	// Completes once the sinks have written everything they were given.
+	task<void> flush();
+
+private:
+	struct sink;
+
+	class drive_task;
+
+	void deliver(uint8_t const * buffer, size_t size);
+	void collect(sink & s);
+	bool blocked() const;
+	bool idle() const;
+
+	stream & m_stream;
+	std::vector<std::unique_ptr<sink> > m_sinks;
+};
+
+} // namespace yb
+
+#endif // LIBYB_ASYNC_TEE_STREAM_HPP
@@ -6,3 +6,9 @@ task<void> yb::wait_ms(int milliseconds)
 	std::shared_ptr<timer> tmr(new timer());
 	return tmr->wait_ms(milliseconds).follow_with([tmr]{});
 }
+
+task<void> yb::wait_us(uint64_t microseconds)
+{
+	std::shared_ptr<timer> tmr(new timer());
+	return tmr->wait_us(microseconds).follow_with([tmr]{});
+}
@@ -3,6 +3,7 @@
 
 #include "task.hpp"
 #include <memory>
+#include <stdint.h>
 
 namespace yb {
 
@@ -13,6 +14,11 @@ public:
 	~timer();
 
 	task<void> wait_ms(int milliseconds);
+	task<void> wait_us(uint64_t microseconds);
+
+	// Waits until `clock_now_us` reaches `deadline_us`. Since the deadline
+	// is absolute, a loop that advances it by a fixed step doesn't drift.
+	task<void> wait_until(uint64_t deadline_us);
 
 private:
 	struct impl;
@@ -22,7 +28,31 @@ private:
 	timer & operator=(timer const &);
 };
 
+// Ticks every `period_us` microseconds, the first tick coming one period
+// after construction. The schedule is kept by the system, so it neither
+// drifts nor has to be re-armed for each tick.
+class interval
+{
+public:
+	explicit interval(uint64_t period_us);
+	~interval();
+
+	uint64_t period_us() const;
+
+	// Completes at the next tick with the number of ticks since
+	// the previous call; anything above one are missed ticks.
+	task<uint64_t> wait();
+
+private:
+	struct impl;
+	std::unique_ptr<impl> m_pimpl;
+
+	interval(interval const &);
+	interval & operator=(interval const &);
+};
+
 task<void> wait_ms(int milliseconds);
+task<void> wait_us(uint64_t microseconds);
 
 } // namespace yb
 
@@ -0,0 +1,72 @@
+#ifndef LIBYB_ASYNC_WHEN_ALL_HPP
+#define LIBYB_ASYNC_WHEN_ALL_HPP
+
+#include "task.hpp"
+#include "detail/when_all_task.hpp"
+#include <tuple>
+
+namespace yb {
+
+// Runs the tasks concurrently and completes with a tuple of their values;
+// `task<void>` contributes a `void_result`. If a task fails, the others
+// are cancelled with `cl_abort` and the first failure is propagated
+// once all of them have finished.
+template <typename... R>
+task<typename detail::when_all_result<R...>::type> when_all(task<R> &&... ts);
+
+// Runs the tasks concurrently and completes with the index of the first
+// one to finish along with the results of all of them. The others are
+// cancelled with `cl_abort` and waited for, so their results are usually
+// `te_cancelled`. If the winner failed, its exception is propagated.
+template <typename... R>
+task<typename detail::when_any_result<R...>::type> when_any(task<R> &&... ts);
+
+} // namespace yb
+
+template <typename... R>
+yb::task<typename yb::detail::when_all_result<R...>::type> yb::when_all(task<R> &&... ts)
+{
+	typedef typename detail::when_all_result<R...>::type result_type;
+
+	if (!detail::any_task(ts...))
+	{
+		detail::task_group<0, R...> group(std::move(ts)...);
+		return detail::make_when_all_result(group, task_result<void>());
+	}
+
+	try
+	{
+		return task<result_type>(new detail::when_all_task<R...>(std::move(ts)...));
+	}
+	catch (...)
+	{
+		detail::task_group<0, R...> group(std::move(ts)...);
+		group.cancel_and_wait();
+		return async::raise<result_type>();
+	}
+}
+
+template <typename... R>
+yb::task<typename yb::detail::when_any_result<R...>::type> yb::when_any(task<R> &&... ts)
+{
+	typedef typename detail::when_any_result<R...>::type result_type;
+
+	if (!detail::any_task(ts...))
+	{
+		detail::task_group<0, R...> group(std::move(ts)...);
+		return detail::make_when_any_result(group, 0);
+	}
+
+	try
+	{
+		return task<result_type>(new detail::when_any_task<R...>(std::move(ts)...));
+	}
+	catch (...)
+	{
+		detail::task_group<0, R...> group(std::move(ts)...);
+		group.cancel_and_wait();
+		return async::raise<result_type>();
+	}
+}
+
+#endif // LIBYB_ASYNC_WHEN_ALL_HPP
@@ -167,7 +167,7 @@ static task<void> read_memory_loop(usb_device & dev, flip2::offset_t address, ui
 		if (chunk == 0)
 			return nulltask;
 		if (cl >= cl_abort)
-			return async::raise<size_t>(task_cancelled(cl));
+			return async::fail<size_t>(te_cancelled);
 		return read_memory_range(dev, address + st, buffer + st, chunk);
 	});
 }
@@ -213,7 +213,7 @@ task<void> flip2::chip_erase()
 			if (status == status_ok)
 				return nulltask;
 			if (cl >= cl_abort)
-				return async::raise<flip_status_t>(task_cancelled(cl));
+				return async::fail<flip_status_t>(te_cancelled);
 			if (status == status_erase_ongoing)
 				return get_status(self->m_device);
 			return async::raise<flip_status_t>(std::runtime_error("erase failure"));
@@ -230,7 +230,7 @@ static task<void> write_memory_loop(usb_device & dev, flip2::offset_t address, u
 		if (chunk == 0)
 			return nulltask;
 		if (cl >= cl_abort)
-			return async::raise<void>(task_cancelled(cl));
+			return async::fail<void>(te_cancelled);
 		st += chunk;
 		return write_memory_range(dev, address + offset, buffer + offset, chunk, packet_size);
 	});
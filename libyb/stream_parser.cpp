@@ -1,15 +1,18 @@
 #include "stream_parser.hpp"
 #include "utils/noncopyable.hpp"
+#include <algorithm>
+#include <cstring>
 #include <utility> // move
 using namespace yb;
 
 stream_parser::stream_parser()
-	: m_packet_pos(0)
+	: m_packet_pos(0), m_partial_size(0)
 {
 }
 
 void stream_parser::parse(packet_handler & h, buffer_ref const & buffer)
 {
+	uint8_t const * data = buffer.data();
 	size_t r = buffer.size();
 
 	for (size_t i = 0; i < r; )
@@ -17,18 +20,21 @@ void stream_parser::parse(packet_handler & h, buffer_ref const & buffer)
 		switch (m_packet_pos)
 		{
 		case 0:
-			while (buffer[i] != 0x80 && i < r)
-				++i;
-			if (i < r)
 			{
+				// Most of the input between packets is line noise;
+				// memchr skips it far faster than a byte loop.
+				void const * sync = std::memchr(data + i, 0x80, r - i);
+				if (!sync)
+					return;
+
+				i = static_cast<uint8_t const *>(sync) - data + 1;
 				m_packet_pos = 1;
-				++i;
 			}
 			break;
 
 		case 1:
-			m_partial_packet.resize((buffer[i] & 0xf) + 1);
-			m_partial_packet[0] = buffer[i] >> 4;
+			m_partial_packet.resize((data[i] & 0xf) + 1);
+			m_partial_packet[0] = data[i] >> 4;
 			++i;
 			++m_packet_pos;
 
@@ -43,20 +49,19 @@ void stream_parser::parse(packet_handler & h, buffer_ref const & buffer)
 			// fallthrough
 
 		default:
-			while (i < r)
 			{
-				m_partial_packet[m_packet_pos-1] = buffer[i];
-				++i;
+				// `m_packet_pos - 1` is the index of the next payload byte.
+				size_t chunk = (std::min)(r - i, m_partial_packet.size() - (m_packet_pos - 1));
+				std::copy(data + i, data + i + chunk, m_partial_packet.begin() + (m_packet_pos - 1));
+				i += chunk;
+				m_packet_pos += chunk;
 
-				if (m_packet_pos == m_partial_packet.size())
+				if (m_packet_pos - 1 == m_partial_packet.size())
 				{
 					h.handle_packet(std::move(m_partial_packet));
 					m_partial_packet.clear();
 					m_packet_pos = 0;
-					break;
 				}
-
-				++m_packet_pos;
 			}
 		}
 	}
@@ -85,3 +90,44 @@ void stream_parser::parse(std::vector<packet> & out, buffer_ref const & buffer)
 	handler h(out);
 	this->parse(h, buffer);
 }
+
+void stream_parser::parse(std::vector<sliced_packet> & out, buffer_slice const & buffer)
+{
+	uint8_t const * data = buffer.data();
+	size_t r = buffer.size();
+
+	for (size_t i = 0; i < r; )
+	{
+		if (m_packet_pos == 0)
+		{
+			void const * sync = std::memchr(data + i, 0x80, r - i);
+			if (!sync)
+				return;
+
+			i = static_cast<uint8_t const *>(sync) - data + 1;
+			m_packet_pos = 1;
+			continue;
+		}
+
+		if (m_packet_pos == 1)
+		{
+			m_partial_slices.command = data[i] >> 4;
+			m_partial_size = data[i] & 0xf;
+			++i;
+			++m_packet_pos;
+		}
+		else
+		{
+			size_t chunk = (std::min)(r - i, m_partial_size - m_partial_slices.payload.size());
+			m_partial_slices.payload.append(buffer.slice(i, chunk));
+			i += chunk;
+		}
+
+		if (m_partial_slices.payload.size() == m_partial_size)
+		{
+			out.push_back(std::move(m_partial_slices));
+			m_partial_slices.payload.clear();
+			m_packet_pos = 0;
+		}
+	}
+}
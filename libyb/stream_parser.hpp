@@ -3,9 +3,17 @@
 
 #include "packet.hpp"
 #include "packet_handler.hpp"
+#include "utils/buffer_chain.hpp"
 
 namespace yb {
 
+// A packet whose payload still lies in the buffers it was read to.
+struct sliced_packet
+{
+	uint8_t command;
+	buffer_chain payload;
+};
+
 class stream_parser
 {
 public:
@@ -14,9 +22,17 @@ public:
 	void parse(std::vector<packet> & out, buffer_ref const & buffer);
 	void parse(packet_handler & handler, buffer_ref const & buffer);
 
+	// Doesn't copy the payloads: they are slices of `buffer`, or of
+	// several read buffers for a packet that spans reads. A parser
+	// must be fed through one kind of `parse` only.
+	void parse(std::vector<sliced_packet> & out, buffer_slice const & buffer);
+
 private:
 	size_t m_packet_pos;
 	packet m_partial_packet;
+
+	sliced_packet m_partial_slices;
+	size_t m_partial_size;
 };
 
 } // namespace yb
@@ -1,9 +1,12 @@
 #include "bulk_stream.hpp"
+#include "detail/bulk_transfer_plan.hpp"
 #include <stdexcept>
+#include <memory>
+#include <vector>
 using namespace yb;
 
 usb_bulk_stream::usb_bulk_stream()
-	: m_dev(0), m_read_ep(0), m_write_ep(0)
+	: m_dev(0), m_read_ep(0), m_write_ep(0), m_write_packet_size(0)
 {
 }
 
@@ -19,6 +22,7 @@ bool usb_bulk_stream::open(usb_device & dev, usb_endpoint_t read_ep, usb_endpoin
 	m_dev = &dev;
 	m_read_ep = read_ep;
 	m_write_ep = write_ep;
+	m_write_packet_size = 0;
 	return true;
 }
 
@@ -26,6 +30,7 @@ bool usb_bulk_stream::claim_and_open(usb_device & dev, usb_interface_guard & g,
 {
 	usb_endpoint_t read_ep = 0;
 	usb_endpoint_t write_ep = 0;
+	size_t write_packet_size = 0;
 
 	for (size_t i = 0; i < idesc.endpoints.size(); ++i)
 	{
@@ -41,6 +46,7 @@ bool usb_bulk_stream::claim_and_open(usb_device & dev, usb_interface_guard & g,
 			if (write_ep)
 				return false;
 			write_ep = idesc.endpoints[i].bEndpointAddress;
+			write_packet_size = idesc.endpoints[i].wMaxPacketSize & 0x7ff;
 		}
 	}
 
@@ -50,6 +56,7 @@ bool usb_bulk_stream::claim_and_open(usb_device & dev, usb_interface_guard & g,
 	m_dev = &dev;
 	m_read_ep = read_ep;
 	m_write_ep = write_ep;
+	m_write_packet_size = write_packet_size;
 	return true;
 }
 
@@ -85,6 +92,7 @@ void usb_bulk_stream::close()
 	m_claimed_intf = 0;
 	m_read_ep = 0;
 	m_write_ep = 0;
+	m_write_packet_size = 0;
 }
 
 bool usb_bulk_stream::is_open() const
@@ -113,3 +121,79 @@ task<size_t> usb_bulk_stream::write(uint8_t const * buffer, size_t size)
 	assert(m_dev && m_write_ep);
 	return m_dev->bulk_write(m_write_ep, buffer, size);
 }
+
+namespace {
+
+struct bulk_writev_state
+{
+	detail::bulk_transfer_plan plan;
+	std::vector<task_result<size_t>> results;
+};
+
+} // namespace
+
+task<size_t> usb_bulk_stream::writev(buffer_ref const * segments, size_t count)
+{
+	assert(m_dev && m_write_ep);
+
+	// An empty transfer would go out as a zero-length packet.
+	while (count && segments[count - 1].empty())
+		--count;
+	if (count == 1)
+		return m_dev->bulk_write(m_write_ep, segments[0].data(), segments[0].size());
+
+	try
+	{
+		std::shared_ptr<bulk_writev_state> st(new bulk_writev_state());
+		detail::plan_bulk_transfers(st->plan, segments, count, m_write_packet_size);
+
+		std::vector<detail::bulk_transfer> const & transfers = st->plan.transfers;
+		if (transfers.empty())
+			return async::value((size_t)0);
+
+		if (transfers.size() == 1)
+		{
+			if (!transfers[0].copied)
+				return m_dev->bulk_write(m_write_ep, transfers[0].data, transfers[0].size);
+			return m_dev->bulk_write(m_write_ep, st->plan.data(0), transfers[0].size).then([st](size_t r) {
+				return async::value(r);
+			});
+		}
+
+		st->results.reserve(transfers.size());
+
+		task<void> all = async::value();
+		for (size_t i = 0; i < transfers.size(); ++i)
+		{
+			st->results.push_back(task_result<size_t>((size_t)0));
+			all |= m_dev->bulk_write(m_write_ep, st->plan.data(i), transfers[i].size).continue_with([st, i](task_result<size_t> r) {
+				st->results[i] = std::move(r);
+				return async::value();
+			});
+		}
+
+		// The transfers are already queued when one of them fails or
+		// comes up short, so the later ones may still reach the device.
+		// The byte count would then not describe what was written;
+		// the whole call fails instead.
+		return all.then([st]() -> task<size_t> {
+			size_t total = 0;
+			for (size_t i = 0; i < st->results.size(); ++i)
+			{
+				task_result<size_t> & r = st->results[i];
+				if (r.has_exception())
+					return async::fail<size_t>(r);
+
+				size_t transferred = r.get();
+				total += transferred;
+				if (transferred != st->plan.transfers[i].size && i + 1 != st->results.size())
+					return async::raise<size_t>(std::runtime_error("bulk transfer was cut short"));
+			}
+			return async::value(total);
+		});
+	}
+	catch (...)
+	{
+		return async::raise<size_t>();
+	}
+}
@@ -26,11 +26,21 @@ public:
 	task<size_t> read(uint8_t * buffer, size_t size);
 	task<size_t> write(uint8_t const * buffer, size_t size);
 
+	// Submits the segments as several transfers at once; the endpoint
+	// queue keeps them in order. Transfers are split only at multiples
+	// of the packet size, so the device sees a single transfer; bytes
+	// around other segment boundaries are copied. Without a known packet
+	// size, i.e. after `open`, the segments are gathered into one write.
+	// If a transfer fails or comes up short before the last one,
+	// the whole call fails, as the later transfers may have gone out.
+	task<size_t> writev(buffer_ref const * segments, size_t count);
+
 private:
 	usb_device * m_dev;
 	uint8_t m_claimed_intf;
 	usb_endpoint_t m_read_ep;
 	usb_endpoint_t m_write_ep;
+	size_t m_write_packet_size;
 };
 
 } // namespace yb
@@ -0,0 +1,65 @@
+#include "bulk_transfer_plan.hpp"
+#include <algorithm>
+using namespace yb;
+using namespace yb::detail;
+
+namespace {
+
+void add(bulk_transfer_plan & plan, uint8_t const * data, size_t size)
+{
+	bulk_transfer t = { data, size, false, 0 };
+	plan.transfers.push_back(t);
+}
+
+void gather(bulk_transfer_plan & plan, uint8_t const * data, size_t size)
+{
+	if (plan.transfers.empty() || !plan.transfers.back().copied)
+	{
+		bulk_transfer t = { 0, 0, true, plan.copies.size() };
+		plan.transfers.push_back(t);
+	}
+
+	plan.copies.insert(plan.copies.end(), data, data + size);
+	plan.transfers.back().size += size;
+}
+
+} // namespace
+
+uint8_t const * bulk_transfer_plan::data(size_t i) const
+{
+	bulk_transfer const & t = transfers[i];
+	return t.copied? copies.data() + t.copy_offset: t.data;
+}
+
+void yb::detail::plan_bulk_transfers(bulk_transfer_plan & plan, buffer_ref const * segments, size_t count, size_t packet_size)
+{
+	for (size_t i = 0; i < count; ++i)
+	{
+		uint8_t const * data = segments[i].data();
+		size_t size = segments[i].size();
+
+		if (packet_size == 0)
+		{
+			gather(plan, data, size);
+			continue;
+		}
+
+		if (!plan.transfers.empty() && plan.transfers.back().copied)
+		{
+			size_t fill = plan.transfers.back().size % packet_size;
+			if (fill != 0)
+			{
+				size_t chunk = (std::min)(size, packet_size - fill);
+				gather(plan, data, chunk);
+				data += chunk;
+				size -= chunk;
+			}
+		}
+
+		size_t direct = i + 1 == count? size: size - size % packet_size;
+		if (direct != 0)
+			add(plan, data, direct);
+		if (size != direct)
+			gather(plan, data + direct, size - direct);
+	}
+}
@@ -0,0 +1,38 @@
+#ifndef LIBYB_USB_DETAIL_BULK_TRANSFER_PLAN_HPP
+#define LIBYB_USB_DETAIL_BULK_TRANSFER_PLAN_HPP
+
+#include "../../vector_ref.hpp"
+#include <vector>
+#include <stdint.h>
+
+namespace yb {
+namespace detail {
+
+struct bulk_transfer
+{
+	uint8_t const * data;
+	size_t size;
+
+	// Set if the transfer is gathered from copies of the segments.
+	bool copied;
+	size_t copy_offset;
+};
+
+struct bulk_transfer_plan
+{
+	std::vector<bulk_transfer> transfers;
+	std::vector<uint8_t> copies;
+
+	uint8_t const * data(size_t i) const;
+};
+
+// Splits the segments into bulk transfers that the device sees as one.
+// Transfers are split only where the data so far fill whole packets;
+// the bytes around the other segment boundaries are copied. With a zero
+// packet size, all the segments are gathered into a single transfer.
+void plan_bulk_transfers(bulk_transfer_plan & plan, buffer_ref const * segments, size_t count, size_t packet_size);
+
+} // namespace detail
+} // namespace yb
+
+#endif // LIBYB_USB_DETAIL_BULK_TRANSFER_PLAN_HPP
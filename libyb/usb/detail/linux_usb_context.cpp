@@ -51,7 +51,7 @@ static task<void> dispatch_loop(std::shared_ptr<usb_device_core> const & core)
 		}
 
 		kill_pending_urbs(*core);
-		return async::raise<void>(std::runtime_error("something bad happened to the device"));
+		return async::fail<void>(te_device_gone);
 	});
 }
 
@@ -3,6 +3,7 @@
 #include "../../utils/utf.hpp"
 #include <stdexcept>
 #include <stdio.h>
+#include <errno.h>
 #include <sys/ioctl.h>
 using namespace yb;
 
@@ -198,7 +199,10 @@ static task<size_t> async_transfer(std::shared_ptr<detail::usb_device_core> cons
 		std::set<detail::urb_context *>::iterator it = core->pending_urbs.insert(ctx.get()).first;
 		if (ioctl(core->fd.get(), USBDEVFS_SUBMITURB, urb) < 0)
 		{
+			int err = errno;
 			core->pending_urbs.erase(it);
+			if (err == ENODEV)
+				return async::fail<size_t>(te_device_gone);
 			return async::raise<size_t>(std::runtime_error("cannot submit urb"));
 		}
 
@@ -207,8 +211,20 @@ static task<size_t> async_transfer(std::shared_ptr<detail::usb_device_core> cons
 				ioctl(core->fd.get(), USBDEVFS_DISCARDURB, &ctx->urb);
 			return true;
 		}).then([ctx]() -> task<size_t> {
-			if (ctx->urb.status < 0)
-				return async::raise<size_t>(std::runtime_error("transfer error"));
+			switch (ctx->urb.status)
+			{
+			case 0:
+				break;
+			case -ENOENT:
+			case -ECONNRESET:
+				return async::fail<size_t>(te_cancelled);
+			case -ENODEV:
+			case -ESHUTDOWN:
+				return async::fail<size_t>(te_device_gone);
+			default:
+				if (ctx->urb.status < 0)
+					return async::raise<size_t>(std::runtime_error("transfer error"));
+			}
 			return async::value((size_t)ctx->urb.actual_length);
 		});
 	});
@@ -0,0 +1,337 @@
+#include "buffer_chain.hpp"
+#include <algorithm>
+#include <vector>
+#include <cassert>
+using namespace yb;
+
+namespace yb {
+namespace detail {
+
+struct buffer_block
+{
+	buffer_pool_core * pool;
+	buffer_block * next_free;
+	int refcount;
+
+	uint8_t * data();
+};
+
+// The data follow the header, aligned to 16 bytes.
+static size_t const block_header_size = (sizeof(buffer_block) + 15) & ~(size_t)15;
+
+uint8_t * buffer_block::data()
+{
+	return reinterpret_cast<uint8_t *>(this) + block_header_size;
+}
+
+struct buffer_pool_core
+{
+	size_t block_size;
+	size_t stride;
+	size_t blocks_per_slab;
+	std::vector<uint8_t *> slabs;
+	buffer_block * free_blocks;
+
+	// The number of blocks in use; the core goes away once the pool
+	// is destroyed and no blocks are left.
+	size_t outstanding;
+	bool orphaned;
+
+	~buffer_pool_core()
+	{
+		for (size_t i = 0; i < slabs.size(); ++i)
+			delete [] slabs[i];
+	}
+
+	void release(buffer_block * block)
+	{
+		block->next_free = free_blocks;
+		free_blocks = block;
+		if (--outstanding == 0 && orphaned)
+			delete this;
+	}
+};
+
+} // namespace detail
+} // namespace yb
+
+using detail::buffer_block;
+using detail::buffer_pool_core;
+
+buffer_slice::buffer_slice()
+	: m_block(0), m_offset(0), m_size(0)
+{
+}
+
+buffer_slice::buffer_slice(buffer_slice const & o)
+	: m_block(o.m_block), m_offset(o.m_offset), m_size(o.m_size)
+{
+	if (m_block)
+		++m_block->refcount;
+}
+
+buffer_slice::buffer_slice(buffer_slice && o)
+	: m_block(o.m_block), m_offset(o.m_offset), m_size(o.m_size)
+{
+	o.m_block = 0;
+	o.m_offset = 0;
+	o.m_size = 0;
+}
+
+buffer_slice::~buffer_slice()
+{
+	this->clear();
+}
+
+buffer_slice & buffer_slice::operator=(buffer_slice o)
+{
+	std::swap(m_block, o.m_block);
+	std::swap(m_offset, o.m_offset);
+	std::swap(m_size, o.m_size);
+	return *this;
+}
+
+void buffer_slice::clear()
+{
+	if (m_block && --m_block->refcount == 0)
+	{
+		if (m_block->pool)
+			m_block->pool->release(m_block);
+		else
+			delete [] reinterpret_cast<uint8_t *>(m_block);
+	}
+
+	m_block = 0;
+	m_offset = 0;
+	m_size = 0;
+}
+
+uint8_t const * buffer_slice::data() const
+{
+	return m_block? m_block->data() + m_offset: 0;
+}
+
+buffer_slice buffer_slice::slice(size_t offset, size_t size) const
+{
+	assert(offset <= m_size);
+
+	buffer_slice res(*this);
+	res.m_offset += offset;
+	res.m_size = (std::min)(size, m_size - offset);
+	return res;
+}
+
+void buffer_slice::remove_prefix(size_t size)
+{
+	assert(size <= m_size);
+	m_offset += size;
+	m_size -= size;
+}
+
+void buffer_slice::shrink(size_t size)
+{
+	assert(size <= m_size);
+	m_size = size;
+}
+
+bool buffer_slice::unique() const
+{
+	return m_block && m_block->refcount == 1;
+}
+
+uint8_t * buffer_slice::writable_data()
+{
+	assert(this->unique());
+	return m_block->data() + m_offset;
+}
+
+buffer_pool::buffer_pool(size_t block_size, size_t blocks_per_slab)
+	: m_core(new buffer_pool_core())
+{
+	assert(block_size != 0 && blocks_per_slab != 0);
+
+	m_core->block_size = block_size;
+	m_core->stride = (detail::block_header_size + block_size + 15) & ~(size_t)15;
+	m_core->blocks_per_slab = blocks_per_slab;
+	m_core->free_blocks = 0;
+	m_core->outstanding = 0;
+	m_core->orphaned = false;
+}
+
+buffer_pool::~buffer_pool()
+{
+	if (m_core->outstanding == 0)
+		delete m_core;
+	else
+		m_core->orphaned = true;
+}
+
+size_t buffer_pool::block_size() const
+{
+	return m_core->block_size;
+}
+
+size_t buffer_pool::slab_count() const
+{
+	return m_core->slabs.size();
+}
+
+buffer_slice buffer_pool::allocate(size_t size)
+{
+	buffer_block * block;
+	if (size > m_core->block_size)
+	{
+		block = reinterpret_cast<buffer_block *>(new uint8_t[detail::block_header_size + size]);
+		block->pool = 0;
+	}
+	else
+	{
+		if (!m_core->free_blocks)
+		{
+			m_core->slabs.reserve(m_core->slabs.size() + 1);
+			uint8_t * slab = new uint8_t[m_core->stride * m_core->blocks_per_slab];
+			m_core->slabs.push_back(slab);
+
+			for (size_t i = m_core->blocks_per_slab; i != 0; --i)
+			{
+				buffer_block * b = reinterpret_cast<buffer_block *>(slab + (i - 1) * m_core->stride);
+				b->pool = m_core;
+				b->next_free = m_core->free_blocks;
+				m_core->free_blocks = b;
+			}
+		}
+
+		block = m_core->free_blocks;
+		m_core->free_blocks = block->next_free;
+		++m_core->outstanding;
+	}
+
+	block->next_free = 0;
+	block->refcount = 1;
+
+	buffer_slice res;
+	res.m_block = block;
+	res.m_size = size;
+	return res;
+}
+
+buffer_slice buffer_pool::copy(buffer_ref const & data)
+{
+	buffer_slice res = this->allocate(data.size());
+	std::copy(data.begin(), data.end(), res.writable_data());
+	return res;
+}
+
+buffer_chain::buffer_chain()
+	: m_size(0)
+{
+}
+
+void buffer_chain::clear()
+{
+	m_slices.clear();
+	m_size = 0;
+}
+
+void buffer_chain::append(buffer_slice const & s)
+{
+	if (!s.empty())
+	{
+		m_slices.push_back(s);
+		m_size += s.size();
+	}
+}
+
+void buffer_chain::append(buffer_slice && s)
+{
+	if (!s.empty())
+	{
+		m_size += s.size();
+		m_slices.push_back(std::move(s));
+	}
+}
+
+void buffer_chain::append(buffer_chain && c)
+{
+	for (size_t i = 0; i < c.m_slices.size(); ++i)
+		m_slices.push_back(std::move(c.m_slices[i]));
+	m_size += c.m_size;
+	c.clear();
+}
+
+uint8_t buffer_chain::operator[](size_t i) const
+{
+	assert(i < m_size);
+
+	size_t seg = 0;
+	while (i >= m_slices[seg].size())
+		i -= m_slices[seg++].size();
+	return m_slices[seg][i];
+}
+
+size_t buffer_chain::copy_to(uint8_t * buffer, size_t size) const
+{
+	size_t res = 0;
+	for (size_t i = 0; res < size && i < m_slices.size(); ++i)
+	{
+		size_t chunk = (std::min)(size - res, m_slices[i].size());
+		std::copy(m_slices[i].begin(), m_slices[i].begin() + chunk, buffer + res);
+		res += chunk;
+	}
+	return res;
+}
+
+buffer_chain buffer_chain::split(size_t size)
+{
+	assert(size <= m_size);
+
+	buffer_chain res;
+	while (size != 0)
+	{
+		buffer_slice & front = m_slices.front();
+		if (front.size() <= size)
+		{
+			size -= front.size();
+			m_size -= front.size();
+			res.append(std::move(front));
+			m_slices.pop_front();
+		}
+		else
+		{
+			res.append(front.slice(0, size));
+			front.remove_prefix(size);
+			m_size -= size;
+			size = 0;
+		}
+	}
+	return res;
+}
+
+void buffer_chain::consume(size_t size)
+{
+	assert(size <= m_size);
+
+	m_size -= size;
+	while (size != 0)
+	{
+		buffer_slice & front = m_slices.front();
+		if (front.size() <= size)
+		{
+			size -= front.size();
+			m_slices.pop_front();
+		}
+		else
+		{
+			front.remove_prefix(size);
+			size = 0;
+		}
+	}
+}
+
+size_t buffer_chain::gather(buffer_ref * segments, size_t count) const
+{
+	size_t res = (std::min)(count, m_slices.size());
+	for (size_t i = 0; i < res; ++i)
+		segments[i] = m_slices[i].ref();
+	return res;
+}
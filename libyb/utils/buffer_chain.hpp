@@ -0,0 +1,124 @@
+#ifndef LIBYB_UTILS_BUFFER_CHAIN_HPP
+#define LIBYB_UTILS_BUFFER_CHAIN_HPP
+
+#include "../vector_ref.hpp"
+#include "noncopyable.hpp"
+#include <deque>
+#include <stdint.h>
+#include <stddef.h>
+
+namespace yb {
+
+namespace detail {
+struct buffer_block;
+struct buffer_pool_core;
+}
+
+// A reference-counted range of bytes in a block allocated by
+// a `buffer_pool`. Copies and sub-slices share the block, which returns
+// to its pool once the last slice referring to it is gone. Slices and
+// pools are not thread-safe.
+class buffer_slice
+{
+public:
+	static size_t const npos = ~(size_t)0;
+
+	buffer_slice();
+	buffer_slice(buffer_slice const & o);
+	buffer_slice(buffer_slice && o);
+	~buffer_slice();
+
+	buffer_slice & operator=(buffer_slice o);
+
+	void clear();
+
+	bool empty() const { return m_size == 0; }
+	size_t size() const { return m_size; }
+	uint8_t const * data() const;
+	uint8_t const * begin() const { return this->data(); }
+	uint8_t const * end() const { return this->data() + m_size; }
+	uint8_t operator[](size_t i) const { return this->data()[i]; }
+
+	buffer_ref ref() const { return buffer_ref(this->data(), m_size); }
+
+	// Returns a slice of this slice pinned to the same block.
+	buffer_slice slice(size_t offset, size_t size = npos) const;
+
+	void remove_prefix(size_t size);
+	void shrink(size_t size);
+
+	// The bytes may only be written to while the block isn't shared,
+	// typically right after the slice was allocated.
+	bool unique() const;
+	uint8_t * writable_data();
+
+private:
+	detail::buffer_block * m_block;
+	size_t m_offset;
+	size_t m_size;
+
+	friend class buffer_pool;
+};
+
+// Hands out fixed-size blocks carved from larger slabs; released blocks
+// are reused. Slices outlive the pool safely, the memory is freed
+// once the last of them is gone.
+class buffer_pool
+	: noncopyable
+{
+public:
+	explicit buffer_pool(size_t block_size = 4096, size_t blocks_per_slab = 16);
+	~buffer_pool();
+
+	size_t block_size() const;
+	size_t slab_count() const;
+
+	// Returns a slice of `size` uninitialized bytes. Requests larger
+	// than a block get a block of their own, which isn't reused.
+	buffer_slice allocate(size_t size);
+	buffer_slice copy(buffer_ref const & data);
+
+private:
+	detail::buffer_pool_core * m_core;
+};
+
+// A sequence of slices read as a single run of bytes. Splitting
+// and consuming the chain only adjusts the slices; the bytes
+// stay where they were read to.
+class buffer_chain
+{
+public:
+	buffer_chain();
+
+	bool empty() const { return m_size == 0; }
+	size_t size() const { return m_size; }
+	void clear();
+
+	void append(buffer_slice const & s);
+	void append(buffer_slice && s);
+	void append(buffer_chain && c);
+
+	size_t segment_count() const { return m_slices.size(); }
+	buffer_slice const & segment(size_t i) const { return m_slices[i]; }
+
+	uint8_t operator[](size_t i) const;
+
+	// Copies up to `size` bytes from the front of the chain.
+	size_t copy_to(uint8_t * buffer, size_t size) const;
+
+	// Removes the first `size` bytes and returns them as a new chain.
+	buffer_chain split(size_t size);
+	void consume(size_t size);
+
+	// Fills in up to `count` segments describing the front of the chain,
+	// e.g. for `stream::writev`, and returns the number used.
+	size_t gather(buffer_ref * segments, size_t count) const;
+
+private:
+	std::deque<buffer_slice> m_slices;
+	size_t m_size;
+};
+
+} // namespace yb
+
+#endif // LIBYB_UTILS_BUFFER_CHAIN_HPP
@@ -0,0 +1,65 @@
+#include "../mapped_file.hpp"
+#include "scoped_unix_fd.hpp"
+#include <stdexcept>
+#include <string>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+using namespace yb;
+
+mapped_file::mapped_file()
+	: m_data(0), m_size(0), m_open(false)
+{
+}
+
+mapped_file::mapped_file(string_ref const & path)
+	: m_data(0), m_size(0), m_open(false)
+{
+	this->open(path);
+}
+
+mapped_file::~mapped_file()
+{
+	this->close();
+}
+
+void mapped_file::open(string_ref const & path)
+{
+	this->close();
+
+	detail::scoped_unix_fd fd(::open(std::string(path).c_str(), O_RDONLY | O_CLOEXEC));
+	if (fd.empty())
+		throw std::runtime_error("cannot open the file");
+
+	struct stat st;
+	if (fstat(fd.get(), &st) != 0)
+		throw std::runtime_error("cannot get the size of the file");
+
+	// Empty files can't be mapped, but they are valid all the same.
+	if (st.st_size != 0)
+	{
+		void * p = mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, fd.get(), 0);
+		if (p == MAP_FAILED)
+			throw std::runtime_error("cannot map the file");
+
+		madvise(p, st.st_size, MADV_SEQUENTIAL);
+#ifdef MADV_HUGEPAGE
+		madvise(p, st.st_size, MADV_HUGEPAGE);
+#endif
+
+		m_data = static_cast<uint8_t const *>(p);
+		m_size = st.st_size;
+	}
+
+	m_open = true;
+}
+
+void mapped_file::close()
+{
+	if (m_data)
+		munmap(const_cast<uint8_t *>(m_data), m_size);
+
+	m_data = 0;
+	m_size = 0;
+	m_open = false;
+}
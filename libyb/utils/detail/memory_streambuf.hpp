@@ -0,0 +1,26 @@
+#ifndef LIBYB_UTILS_DETAIL_MEMORY_STREAMBUF_HPP
+#define LIBYB_UTILS_DETAIL_MEMORY_STREAMBUF_HPP
+
+#include "../../vector_ref.hpp"
+#include <streambuf>
+
+namespace yb {
+namespace detail {
+
+// Lets the stream-based parsers read straight from memory
+// without the copy `std::istringstream` would make.
+class memory_streambuf
+	: public std::streambuf
+{
+public:
+	explicit memory_streambuf(string_ref const & data)
+	{
+		char * p = const_cast<char *>(data.data());
+		this->setg(p, p, p + data.size());
+	}
+};
+
+} // namespace detail
+} // namespace yb
+
+#endif // LIBYB_UTILS_DETAIL_MEMORY_STREAMBUF_HPP
@@ -0,0 +1,65 @@
+#include "../mapped_file.hpp"
+#include "scoped_win32_handle.hpp"
+#include <stdexcept>
+#include <string>
+#include <windows.h>
+using namespace yb;
+
+mapped_file::mapped_file()
+	: m_data(0), m_size(0), m_open(false)
+{
+}
+
+mapped_file::mapped_file(string_ref const & path)
+	: m_data(0), m_size(0), m_open(false)
+{
+	this->open(path);
+}
+
+mapped_file::~mapped_file()
+{
+	this->close();
+}
+
+void mapped_file::open(string_ref const & path)
+{
+	this->close();
+
+	detail::scoped_win32_handle file(CreateFileA(std::string(path).c_str(), GENERIC_READ, FILE_SHARE_READ, NULL,
+		OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL));
+	if (file.empty())
+		throw std::runtime_error("cannot open the file");
+
+	LARGE_INTEGER size;
+	if (!GetFileSizeEx(file.get(), &size))
+		throw std::runtime_error("cannot get the size of the file");
+
+	// Empty files can't be mapped, but they are valid all the same.
+	if (size.QuadPart != 0)
+	{
+		HANDLE mapping = CreateFileMappingW(file.get(), NULL, PAGE_READONLY, 0, 0, NULL);
+		if (!mapping)
+			throw std::runtime_error("cannot map the file");
+
+		// The view keeps the mapping alive.
+		void * p = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+		CloseHandle(mapping);
+		if (!p)
+			throw std::runtime_error("cannot map the file");
+
+		m_data = static_cast<uint8_t const *>(p);
+		m_size = (size_t)size.QuadPart;
+	}
+
+	m_open = true;
+}
+
+void mapped_file::close()
+{
+	if (m_data)
+		UnmapViewOfFile(m_data);
+
+	m_data = 0;
+	m_size = 0;
+	m_open = false;
+}
@@ -1,5 +1,5 @@
 #include "ihex_file.hpp"
-#include <sstream>
+#include "detail/memory_streambuf.hpp"
 #include <cassert>
 using namespace yb;
 
@@ -55,7 +55,8 @@ int ihex_parse_error::line() const
 
 yb::sparse_buffer yb::parse_ihex(string_ref const & data)
 {
-	std::istringstream ss(data);
+	detail::memory_streambuf buf(data);
+	std::istream ss(&buf);
 	return parse_ihex(ss);
 }
 
@@ -0,0 +1,42 @@
+#ifndef LIBYB_UTILS_MAPPED_FILE_HPP
+#define LIBYB_UTILS_MAPPED_FILE_HPP
+
+#include "../vector_ref.hpp"
+#include "noncopyable.hpp"
+#include <stdint.h>
+#include <stddef.h>
+
+namespace yb {
+
+// A read-only view of a whole file mapped into memory. The pages
+// are read in as they are touched; the kernel is told to expect
+// sequential access and to use huge pages if it can.
+class mapped_file
+	: noncopyable
+{
+public:
+	mapped_file();
+	explicit mapped_file(string_ref const & path);
+	~mapped_file();
+
+	// Throws `std::runtime_error` if the file can't be mapped.
+	void open(string_ref const & path);
+	void close();
+
+	bool is_open() const { return m_open; }
+
+	uint8_t const * data() const { return m_data; }
+	size_t size() const { return m_size; }
+
+	buffer_ref bytes() const { return buffer_ref(m_data, m_size); }
+	string_ref text() const { return string_ref(reinterpret_cast<char const *>(m_data), m_size); }
+
+private:
+	uint8_t const * m_data;
+	size_t m_size;
+	bool m_open;
+};
+
+} // namespace yb
+
+#endif // LIBYB_UTILS_MAPPED_FILE_HPP
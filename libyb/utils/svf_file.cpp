@@ -1,4 +1,5 @@
 #include "svf_file.hpp"
+#include "detail/memory_streambuf.hpp"
 #include <sstream>
 #include <cassert>
 #include <algorithm>
@@ -482,6 +483,13 @@ svf_file yb::svf_parse(std::istream & s)
 	return std::move(ctx.stmts);
 }
 
+svf_file yb::svf_parse(string_ref const & data)
+{
+	detail::memory_streambuf buf(data);
+	std::istream s(&buf);
+	return svf_parse(s);
+}
+
 static void merge_xxr(svf_xxr & dest, svf_xxr const & source)
 {
 	// Note that source is not lowered and may therefore have missing
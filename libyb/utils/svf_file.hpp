@@ -1,6 +1,7 @@
 #ifndef LIBYB_UTILS_SVF_PARSER_HPP
 #define LIBYB_UTILS_SVF_PARSER_HPP
 
+#include "../vector_ref.hpp"
 #include <iostream>
 #include <vector>
 #include <string>
@@ -154,6 +155,7 @@ struct svf_tms_path
 typedef std::vector<std::unique_ptr<svf_statement> > svf_file;
 
 svf_file svf_parse(std::istream & s);
+svf_file svf_parse(string_ref const & data);
 svf_file svf_lower(svf_file & doc);
 void svf_lower(svf_file & doc, std::function<void(std::unique_ptr<svf_statement> &)> const & visitor);
 
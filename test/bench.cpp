@@ -0,0 +1,161 @@
+#include "test.h"
+#include <libyb/async/task.hpp>
+#include <libyb/async/async_channel.hpp>
+#include <libyb/async/sync_runner.hpp>
+#include <libyb/stream_parser.hpp>
+#include <chrono>
+#include <iostream>
+#include <memory>
+#include <vector>
+
+namespace {
+
+template <typename F>
+void bench(char const * name, size_t iterations, F f)
+{
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	for (size_t i = 0; i < iterations; ++i)
+		f();
+	std::chrono::steady_clock::duration elapsed = std::chrono::steady_clock::now() - start;
+
+	long long ns = std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count();
+	std::cout << "    " << name << ": " << ns / (long long)iterations << " ns/iter" << std::endl;
+}
+
+template <typename Fail>
+void failing_chain(Fail fail)
+{
+	yb::task<size_t> t = fail().then([](size_t r) {
+		return r + 1;
+	}).then([](size_t r) {
+		return r * 2;
+	});
+
+	yb::task_result<size_t> r = t.get_result();
+	assert(r.has_exception());
+	(void)r;
+}
+
+template <typename Fail>
+void failing_loop(Fail fail)
+{
+	yb::task<void> t = yb::loop<size_t>(yb::async::value((size_t)0), [&fail](size_t, yb::cancel_level) {
+		return fail();
+	});
+
+	assert(t.has_result() && t.get_result().has_exception());
+}
+
+} // namespace
+
+TEST_CASE(BenchTaskFailure, "+bench")
+{
+	size_t const iterations = 200000;
+
+	bench("then chain, exception", iterations, [] {
+		failing_chain([] { return yb::async::raise<size_t>(yb::task_cancelled()); });
+	});
+
+	bench("then chain, error code", iterations, [] {
+		failing_chain([] { return yb::async::fail<size_t>(yb::te_cancelled); });
+	});
+
+	bench("loop, exception", iterations, [] {
+		failing_loop([] { return yb::async::raise<size_t>(yb::task_cancelled()); });
+	});
+
+	bench("loop, error code", iterations, [] {
+		failing_loop([] { return yb::async::fail<size_t>(yb::te_cancelled); });
+	});
+}
+
+TEST_CASE(BenchIdleSiblings, "+bench")
+{
+	// One task ping-pongs through an async channel while the others wait
+	// on channels that never fire; each iteration is one runner round.
+	size_t const idle_count = 500;
+	size_t const iterations = 2000;
+
+	std::vector<std::unique_ptr<yb::async_channel<int> > > idle;
+	std::vector<std::vector<int> > idle_data(idle_count);
+	yb::task<void> idle_tasks;
+	for (size_t i = 0; i < idle_count; ++i)
+	{
+		idle.push_back(std::unique_ptr<yb::async_channel<int> >(new yb::async_channel<int>()));
+		idle_tasks |= idle.back()->receive(idle_data[i]);
+	}
+
+	yb::sync_runner runner;
+	yb::async_channel<int> ch;
+	std::vector<int> data;
+
+	size_t count = 0;
+	yb::task<void> busy = yb::loop([&](yb::cancel_level cl) -> yb::task<void> {
+		if (cl >= yb::cl_quit || count == iterations)
+			return yb::nulltask;
+		++count;
+		ch.send(1);
+		return ch.receive(data);
+	});
+
+	runner.post_detached(std::move(idle_tasks));
+
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	runner.run(std::move(busy));
+	std::chrono::steady_clock::duration elapsed = std::chrono::steady_clock::now() - start;
+
+	long long ns = std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count();
+	std::cout << "    runner round, " << idle_count << " idle siblings: " << ns / (long long)iterations << " ns/round" << std::endl;
+}
+
+TEST_CASE(BenchStreamParser, "+bench")
+{
+	// Mostly line noise with a frame every 4 KiB, and frames back to back.
+	std::vector<uint8_t> noisy(1 << 20), framed;
+	uint32_t seed = 1;
+	for (size_t i = 0; i < noisy.size(); ++i)
+	{
+		seed = seed * 1103515245 + 12345;
+		noisy[i] = (uint8_t)(seed >> 16) & 0x7f;
+	}
+
+	for (size_t i = 0; i + 17 <= noisy.size(); i += 4096)
+	{
+		noisy[i] = 0x80;
+		noisy[i + 1] = 0x1f;
+	}
+
+	while (framed.size() + 17 <= noisy.size())
+	{
+		framed.push_back(0x80);
+		framed.push_back(0x1f);
+		framed.insert(framed.end(), noisy.begin() + 2, noisy.begin() + 17);
+	}
+
+	struct counter
+		: yb::packet_handler
+	{
+		size_t packets;
+		void handle_packet(yb::packet const &) { ++packets; }
+	};
+
+	struct input { char const * name; std::vector<uint8_t> const * data; };
+	input const inputs[] = { { "noisy", &noisy }, { "framed", &framed } };
+	for (size_t k = 0; k < 2; ++k)
+	{
+		size_t const iterations = 20;
+		yb::stream_parser parser;
+		counter c;
+		c.packets = 0;
+
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		for (size_t i = 0; i < iterations; ++i)
+			parser.parse(c, *inputs[k].data);
+		std::chrono::steady_clock::duration elapsed = std::chrono::steady_clock::now() - start;
+
+		double s = std::chrono::duration_cast<std::chrono::duration<double> >(elapsed).count();
+		std::cout << "    stream_parser, " << inputs[k].name << ": "
+			<< (long long)(inputs[k].data->size() * iterations / s / 1000000) << " MB/s, "
+			<< c.packets / iterations << " packets/pass" << std::endl;
+	}
+}
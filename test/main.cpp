@@ -1,6 +1,7 @@
 #include "memmock.h"
 #include "test.h"
 #include <vector>
+#include <algorithm>
 
 #include <libyb/async/task.hpp>
 #include <libyb/async/sync_runner.hpp>
@@ -11,6 +12,46 @@
 #include <libyb/async/stream_device.hpp>
 #include <libyb/async/descriptor_reader.hpp>
 #include <libyb/async/mock_stream.hpp>
+#include <libyb/async/when_all.hpp>
+#include <libyb/async/clock.hpp>
+#include <libyb/async/buffered_stream.hpp>
+#include <libyb/async/mapped_file_stream.hpp>
+#include <libyb/async/metered_stream.hpp>
+#include <libyb/async/paced_stream.hpp>
+#include <libyb/async/recording_stream.hpp>
+#include <libyb/async/stream_pair.hpp>
+#include <libyb/async/tee_stream.hpp>
+#include <libyb/utils/buffer_chain.hpp>
+#include <libyb/stream_parser.hpp>
+#include <libyb/usb/detail/bulk_transfer_plan.hpp>
+#include <libyb/utils/ihex_file.hpp>
+#include <fstream>
+#include <sstream>
+#include <cstdio>
+#include <stdexcept>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <unistd.h>
+#include <libyb/async/embedded_runner.hpp>
+#include <libyb/async/fd_stream.hpp>
+#include <libyb/async/offload.hpp>
+#include <libyb/async/socket_stream.hpp>
+#include <libyb/async/detail/linux_fdpoll_task.hpp>
+#include <libyb/utils/detail/scoped_unix_fd.hpp>
+#include <sys/poll.h>
+#include <sys/socket.h>
+#endif
+
+static void sleep_ms(int ms)
+{
+#ifdef _WIN32
+	Sleep(ms);
+#else
+	usleep(ms * 1000);
+#endif
+}
 
 TEST_CASE(ValueTaskTest, "value_task")
 {
@@ -59,6 +100,31 @@ TEST_CASE(TimerTask, "timer_task")
 	}
 }
 
+TEST_CASE(IntervalTask, "timer_task")
+{
+	yb::sync_runner runner;
+
+	yb::timer tmr;
+	uint64_t deadline = yb::clock_now_us() + 2000;
+	runner.run(tmr.wait_until(deadline));
+	assert(yb::clock_now_us() >= deadline);
+
+	// 2 kHz; the ticks keep coming while the loop is busy
+	// and are reported as missed rather than shifted.
+	yb::interval ticker(500);
+	uint64_t start = yb::clock_now_us();
+	uint64_t ticks = 0;
+	for (int i = 0; i < 10; ++i)
+	{
+		ticks += runner.run(ticker.wait());
+		if (i == 5)
+			sleep_ms(2);
+	}
+
+	assert(ticks >= 10 + 3);
+	assert(yb::clock_now_us() - start >= ticks * 500);
+}
+
 TEST_CASE(ChannelTask, "channel_task")
 {
 	yb::timer tmr;
@@ -136,6 +202,965 @@ TEST_CASE(ReadDescriptorTask_AsyncRunner, "signal_task async_runner")
 	assert(config);
 }
 
+TEST_CASE(WhenAllTask, "when_all")
+{
+	yb::timer tmr1, tmr2;
+
+	std::tuple<yb::void_result, int, std::string> res = yb::sync_runner().run(yb::when_all(
+		tmr1.wait_ms(1),
+		yb::async::value(42),
+		tmr2.wait_ms(2).then([] { return yb::async::value(std::string("done")); })));
+
+	assert(std::get<1>(res) == 42);
+	assert(std::get<2>(res) == "done");
+
+	yb::channel<int> never = yb::channel<int>::create();
+	yb::task_result<std::tuple<int, yb::void_result> > r = yb::sync_runner().try_run(yb::when_all(
+		never.receive(),
+		tmr1.wait_ms(1).then([] { return yb::async::raise<void>(std::runtime_error("failed")); })));
+	assert(r.has_exception());
+
+	// A task that has already failed cancels the others right away.
+	uint64_t start = yb::clock_now_us();
+	yb::task_result<std::tuple<yb::void_result, int> > r2 = yb::sync_runner().try_run(yb::when_all(
+		tmr1.wait_ms(2000),
+		yb::async::raise<int>(std::runtime_error("failed"))));
+	assert(r2.has_exception());
+	assert(yb::clock_now_us() - start < 1000000);
+}
+
+TEST_CASE(WhenAnyTask, "when_any")
+{
+	yb::timer tmr;
+	yb::channel<int> never = yb::channel<int>::create();
+
+	size_t winner = yb::sync_runner().run(yb::when_any(never.receive(), tmr.wait_ms(1))).first;
+	assert(winner == 1);
+
+	// The winner's value comes along; the loser was cancelled.
+	yb::timer tmr2;
+	std::pair<size_t, std::tuple<yb::task_result<int>, yb::task_result<void> > > res = yb::sync_runner().run(yb::when_any(
+		tmr.wait_ms(1).then([] { return 42; }),
+		tmr2.wait_ms(5000)));
+	assert(res.first == 0);
+	assert(std::get<0>(res.second).get() == 42);
+	assert(std::get<1>(res.second).has_exception());
+}
+
+#ifndef _WIN32
+TEST_CASE(AsyncRunnerWatchdog, "async_runner watchdog")
+{
+	yb::timer tmr;
+	yb::async_runner runner;
+
+	int stalls = 0;
+	runner.enable_watchdog(10, [&stalls](yb::async_runner_stall const & stall) {
+		assert(stall.promise != 0 && stall.task_type != 0);
+		++stalls;
+	});
+
+	runner.run(tmr.wait_ms(1).then([] { sleep_ms(100); }));
+
+	yb::async_runner_metrics m = runner.metrics();
+	assert(stalls == 1);
+	assert(m.stall_count == 1);
+	assert(m.longest_stall_us >= 100000);
+}
+#endif
+
+TEST_CASE(TaskErrorCode, "task_error")
+{
+	yb::task<size_t> t = yb::async::fail<size_t>(yb::te_eof).then([](size_t r) { return r + 1; });
+	assert(t.has_result());
+
+	yb::task_result<size_t> r = t.get_result();
+	assert(r.has_exception() && r.has_error() && r.error() == yb::te_eof);
+
+	try
+	{
+		r.rethrow();
+		assert(false);
+	}
+	catch (yb::task_error_exception const & e)
+	{
+		assert(e.error() == yb::te_eof);
+	}
+
+	yb::channel<int> ch = yb::channel<int>::create();
+	yb::task<void> c = ch.receive().ignore_result().finish_on(yb::cl_quit);
+	c.cancel(yb::cl_quit);
+	yb::sync_runner().run(std::move(c));
+}
+
+TEST_CASE(ReadyContinuations, "trampoline async_runner")
+{
+	// The receive tasks are created while their channels are empty,
+	// so each one is a pending task that is ready once prepared.
+	size_t const count = 1000;
+	std::vector<yb::channel<int> > channels;
+	std::vector<yb::task<int> > receives;
+	for (size_t i = 0; i < count; ++i)
+	{
+		channels.push_back(yb::channel<int>::create());
+		receives.push_back(channels.back().receive());
+		channels.back().send((int)i);
+	}
+
+	yb::async_runner runner;
+	uint64_t first_iteration = runner.metrics().iterations;
+
+	int sum = 0;
+	runner.run(yb::loop_with_state<int, size_t>(yb::async::value(0), 0, [&](int value, size_t & i, yb::cancel_level) -> yb::task<int> {
+		sum += value;
+		if (i == count)
+			return yb::nulltask;
+		return std::move(receives[i++]);
+	}));
+
+	assert(sum == (int)(count * (count - 1) / 2));
+	assert(runner.metrics().iterations - first_iteration < 10);
+}
+
+TEST_CASE(YieldInLoop, "yield loop async_runner")
+{
+	// Each yield takes a round that polls and a round that finishes it,
+	// also when the loop probes the yield as a new continuation.
+	size_t const count = 100;
+	yb::async_runner runner;
+	uint64_t first_iteration = runner.metrics().iterations;
+
+	size_t i = 0;
+	runner.run(yb::loop([&](yb::cancel_level) -> yb::task<void> {
+		if (i++ == count)
+			return yb::nulltask;
+		return yb::async::yield();
+	}));
+
+	assert(runner.metrics().iterations - first_iteration >= 2 * count);
+}
+
+TEST_CASE(WorkBudget, "trampoline sync_runner")
+{
+	yb::sync_runner runner;
+	runner.set_work_budget(16);
+
+	// The loop never waits for anything, but the timer still fires.
+	yb::channel<int> ch = yb::channel<int>::create();
+	yb::timer tmr;
+	bool stop = false;
+	runner.post_detached(tmr.wait_ms(1).then([&] { stop = true; }));
+	runner.run(yb::loop([&](yb::cancel_level) -> yb::task<void> {
+		if (stop)
+			return yb::nulltask;
+		yb::task<int> r = ch.receive();
+		ch.send(1);
+		return r.ignore_result();
+	}));
+
+	stop = false;
+	runner.post_detached(tmr.wait_ms(1).then([&] { stop = true; }));
+	runner.run(yb::loop([&](yb::cancel_level) -> yb::task<void> {
+		if (stop)
+			return yb::nulltask;
+		return yb::async::yield();
+	}));
+}
+
+TEST_CASE(ParallelManyTasks, "parallel_task")
+{
+	size_t const count = 100;
+	std::vector<std::unique_ptr<yb::timer> > timers;
+
+	size_t finished = 0;
+	yb::task<void> t;
+	for (size_t i = 0; i < count; ++i)
+	{
+		timers.push_back(std::unique_ptr<yb::timer>(new yb::timer()));
+		t |= timers.back()->wait_ms(1 + i % 5).then([&finished] { ++finished; });
+	}
+
+	yb::sync_runner().run(std::move(t));
+	assert(finished == count);
+}
+
+TEST_CASE(ParallelPostFromContinuation, "parallel_task sync_runner")
+{
+	yb::sync_runner runner;
+	yb::timer tmr1, tmr2, tmr3;
+
+	// The continuation runs while the runner's parallel node
+	// is finishing it and posts more tasks to the same node.
+	size_t finished = 0;
+	runner.post_detached(tmr1.wait_ms(1));
+	runner.post_detached(tmr2.wait_ms(2));
+	runner.post_detached(tmr3.wait_ms(1).then([&] {
+		for (size_t i = 0; i < 20; ++i)
+			runner.post_detached(yb::async::yield().then([&finished] { ++finished; }));
+	}));
+
+	yb::timer tmr;
+	runner.run(tmr.wait_ms(10));
+	assert(finished == 20);
+}
+
+TEST_CASE(AsyncFutureAsTask, "async_runner sync_runner")
+{
+	yb::async_runner runner;
+	yb::timer tmr;
+
+	yb::async_future<int> f = runner.post(tmr.wait_ms(1).then([] { return 42; }));
+	int res = yb::sync_runner().run(f.as_task().then([](int r) { return r + 1; }));
+	assert(res == 43);
+	assert(f.empty());
+
+	// Cancelling the task cancels the promise on the other runner.
+	yb::channel<int> ch = yb::channel<int>::create();
+	yb::async_future<int> pending = runner.post(ch.receive());
+	yb::timer tmr2;
+	size_t winner = yb::sync_runner().run(yb::when_any(pending.as_task(), tmr2.wait_ms(1))).first;
+	assert(winner == 1);
+}
+
+TEST_CASE(VirtualClock, "timer sync_runner")
+{
+	yb::virtual_clock clock;
+	yb::virtual_clock_scope clock_scope(clock);
+
+	// An hour of once-a-second pings against a mock stream.
+	size_t const count = 3600;
+	uint8_t const ping[] = { 'p' };
+
+	yb::mock_stream sp;
+	for (size_t i = 0; i < count; ++i)
+		sp.expect_write(ping);
+
+	yb::timer tmr;
+	size_t sent = 0;
+	yb::sync_runner runner;
+	runner.run(yb::loop([&](yb::cancel_level cl) -> yb::task<void> {
+		if (cl >= yb::cl_quit || sent == count)
+			return yb::nulltask;
+		return tmr.wait_ms(1000).then([&] {
+			return sp.write(ping, sizeof ping);
+		}).then([&](size_t) {
+			++sent;
+		});
+	}));
+
+	assert(sent == count);
+	assert(clock.now_us() == count * 1000000ull);
+
+	// The earlier deadline wins and the other timer is cancelled.
+	yb::timer tmr2;
+	size_t winner = runner.run(yb::when_any(tmr.wait_ms(5000), tmr2.wait_ms(10))).first;
+	assert(winner == 1);
+	assert(clock.now_us() == count * 1000000ull + 10000);
+
+	yb::interval ticker(250);
+	assert(runner.run(ticker.wait()) == 1);
+	clock.advance_us(1000);
+	assert(runner.run(ticker.wait()) == 4);
+	assert(runner.run(ticker.wait()) == 1);
+}
+
+TEST_CASE(BufferedStream, "buffered_stream")
+{
+	static uint8_t const request[] = { 'h', 'e', 'l', 'l', 'o', ' ', 'w', 'o', 'r', 'l', 'd' };
+	static uint8_t const response[] = { 'r', 'e', 's', 'p', 'o', 'n', 's', 'e' };
+	static uint8_t const bye[] = { 'b', 'y', 'e' };
+
+	yb::mock_stream ms;
+	ms.expect_write(request);
+	ms.expect_read(response);
+	ms.expect_write(bye);
+
+	yb::sync_runner runner;
+	yb::buffered_stream bs(ms, 16, 16);
+	bs.set_write_threshold(16, ~0ull);
+
+	// Small writes are coalesced and complete right away.
+	assert(bs.write_all(request, 5).has_result());
+	assert(bs.write_all(request + 5, 6).has_result());
+	assert(bs.buffered_output() == sizeof request);
+
+	// Reading writes out the pending output first; the response
+	// then arrives in one read and is handed out from the buffer.
+	uint8_t buf[8];
+	assert(runner.run(bs.read(buf, 1)) == 1);
+	assert(bs.buffered_output() == 0);
+	assert(bs.buffered_input() == 7);
+
+	yb::buffer_ref peeked = runner.run(bs.peek());
+	assert(peeked == yb::buffer_ref(response + 1, 7));
+	bs.consume(3);
+
+	yb::task<size_t> rd = bs.read(buf, sizeof buf);
+	assert(rd.has_result());
+	assert(rd.get_result().get() == 4);
+	assert(std::equal(buf, buf + 4, response + 4));
+
+	assert(bs.write_all(bye, sizeof bye).has_result());
+	runner.run(bs.flush());
+	assert(bs.buffered_output() == 0);
+}
+
+TEST_CASE(BufferChain, "buffer_chain")
+{
+	static uint8_t const data[] = { 1, 2, 3, 4, 5, 6, 7, 8 };
+
+	yb::buffer_chain chain;
+	{
+		yb::buffer_pool pool(4, 2);
+		yb::buffer_slice a = pool.copy(yb::buffer_ref(data, 4));
+		yb::buffer_slice b = pool.copy(yb::buffer_ref(data + 4, 4));
+		assert(pool.slab_count() == 1);
+
+		chain.append(a.slice(1));
+		chain.append(b);
+		assert(chain.size() == 7 && chain.segment_count() == 2);
+		assert(chain[0] == 2 && chain[3] == 5);
+
+		// Splitting pins the new chain to the same blocks.
+		yb::buffer_chain head = chain.split(4);
+		assert(head.size() == 4 && chain.size() == 3);
+		assert(head.segment(1).data() == b.data());
+		assert(!b.unique());
+
+		uint8_t buf[4];
+		assert(head.copy_to(buf, sizeof buf) == 4);
+		assert(std::equal(buf, buf + 4, data + 1));
+
+		// Released blocks are reused before a new slab is allocated.
+		a.clear();
+		head.clear();
+		yb::buffer_slice c = pool.allocate(4);
+		assert(pool.slab_count() == 1);
+		assert(c.unique());
+	}
+
+	// The chain keeps its blocks alive past the pool.
+	yb::buffer_ref segments[2];
+	assert(chain.gather(segments, 2) == 1);
+	assert(segments[0] == yb::buffer_ref(data + 5, 3));
+	chain.consume(2);
+	assert(chain.size() == 1 && chain[0] == 8);
+}
+
+TEST_CASE(CopyFromClosedSource, "copy")
+{
+	// The source fails on its very first read, before anything waits.
+	struct closed_stream
+		: yb::stream
+	{
+		yb::task<size_t> read(uint8_t *, size_t) { return yb::async::fail<size_t>(yb::te_eof); }
+		yb::task<size_t> write(uint8_t const *, size_t size) { return yb::async::value(size); }
+	};
+
+	closed_stream source, sink;
+	yb::sync_runner runner;
+	yb::task_result<void> r = runner.try_run(yb::copy(sink, source));
+	assert(r.has_error() && r.error() == yb::te_eof);
+}
+
+TEST_CASE(GatherWrite, "stream writev")
+{
+	static uint8_t const packet[] = { 0x80, 0x12, 'a', 'b', 'c' };
+
+	yb::mock_stream ms;
+	ms.expect_write(packet);
+
+	// The fallback writes one segment at a time.
+	yb::buffer_ref segments[] = {
+		yb::buffer_ref(packet, 2),
+		yb::buffer_ref(),
+		yb::buffer_ref(packet + 2, 3),
+	};
+
+	yb::sync_runner runner;
+	runner.run(ms.writev_all(segments, 3));
+}
+
+TEST_CASE(BulkTransferPlan, "usb_bulk_stream writev splitting")
+{
+	uint8_t data[200];
+	for (size_t i = 0; i < sizeof data; ++i)
+		data[i] = (uint8_t)i;
+
+	// Segments of 64, 10, 100 and 26 bytes with 64-byte packets.
+	yb::buffer_ref segments[] = {
+		yb::buffer_ref(data, 64),
+		yb::buffer_ref(data + 64, 10),
+		yb::buffer_ref(data + 74, 100),
+		yb::buffer_ref(data + 174, 26),
+	};
+
+	yb::detail::bulk_transfer_plan plan;
+	yb::detail::plan_bulk_transfers(plan, segments, 4, 64);
+
+	// Every transfer but the last must fill whole packets,
+	// and together they must carry the segments in order.
+	std::vector<uint8_t> sent;
+	for (size_t i = 0; i < plan.transfers.size(); ++i)
+	{
+		size_t size = plan.transfers[i].size;
+		assert(size != 0);
+		assert(i + 1 == plan.transfers.size() || size % 64 == 0);
+		sent.insert(sent.end(), plan.data(i), plan.data(i) + size);
+	}
+	assert(sent.size() == sizeof data && std::equal(sent.begin(), sent.end(), data));
+
+	// 64 bytes go in place, the next 128 are copied together,
+	// and the last 8 go in place again.
+	assert(plan.transfers.size() == 3);
+	assert(!plan.transfers[0].copied && plan.transfers[0].data == data);
+	assert(plan.transfers[1].copied && plan.transfers[1].size == 128);
+	assert(!plan.transfers[2].copied && plan.transfers[2].data == data + 192);
+	assert(plan.copies.size() == 128);
+
+	// Aligned segments are sent in place without copies.
+	yb::buffer_ref aligned[] = {
+		yb::buffer_ref(data, 128),
+		yb::buffer_ref(data + 128, 72),
+	};
+
+	yb::detail::bulk_transfer_plan aligned_plan;
+	yb::detail::plan_bulk_transfers(aligned_plan, aligned, 2, 64);
+	assert(aligned_plan.transfers.size() == 2 && aligned_plan.copies.empty());
+	assert(aligned_plan.transfers[0].size == 128 && aligned_plan.transfers[1].size == 72);
+
+	// Without a packet size, everything is gathered into one transfer.
+	yb::detail::bulk_transfer_plan gathered;
+	yb::detail::plan_bulk_transfers(gathered, segments, 4, 0);
+	assert(gathered.transfers.size() == 1 && gathered.transfers[0].size == sizeof data);
+}
+
+TEST_CASE(MappedFile, "mapped_file ihex")
+{
+	char const * path = "libyb-test-mapped.hex";
+	{
+		std::ofstream fout(path, std::ios::binary);
+		fout << ":0400000001020304F2\r\n:00000001FF\r\n";
+	}
+
+	{
+		yb::mapped_file f(path);
+		yb::sparse_buffer sb = yb::parse_ihex(f.text());
+		uint8_t image[4];
+		sb.read_region(0, image, sizeof image);
+		assert(sb.top_address() == 4 && image[0] == 1 && image[3] == 4);
+
+		yb::mapped_file_stream s(path);
+		assert(s.file().size() == f.size());
+
+		yb::sync_runner runner;
+		std::vector<uint8_t> buf(f.size() + 8);
+		size_t len = runner.run(s.read(buf.data(), 10));
+		assert(len == 10);
+		len += runner.run(s.read(buf.data() + len, buf.size() - len));
+		assert(len == f.size() && std::equal(buf.begin(), buf.begin() + len, f.data()));
+
+		yb::task_result<size_t> r = runner.try_run(s.read(buf.data(), buf.size()));
+		assert(r.has_error() && r.error() == yb::te_eof);
+	}
+
+	std::remove(path);
+
+	yb::mapped_file empty;
+	assert(!empty.is_open() && empty.text().empty());
+}
+
+TEST_CASE(RecordAndReplay, "recording_stream replay_stream")
+{
+	yb::virtual_clock clock(1000);
+	yb::virtual_clock_scope clock_scope(clock);
+	yb::sync_runner runner;
+
+	uint8_t const hello[] = { 'h', 'e', 'l', 'l', 'o' };
+	uint8_t const ok[] = { 'o', 'k' };
+	uint8_t const bye[] = { 'b', 'y', 'e' };
+
+	yb::mock_stream device;
+	device.expect_read(hello);
+	device.expect_write(ok);
+	device.expect_read(bye);
+
+	std::ostringstream log;
+	uint8_t buf[8];
+	{
+		yb::recording_stream rec(device, log);
+		assert(runner.run(rec.read(buf, sizeof buf)) == 5);
+		clock.advance_us(500);
+		runner.run(rec.write_all(ok, sizeof ok));
+		clock.advance_us(1500);
+		assert(runner.run(rec.read(buf, sizeof buf)) == 3);
+	}
+
+	std::string data = log.str();
+	yb::buffer_ref log_ref(reinterpret_cast<uint8_t const *>(data.data()), data.size());
+
+	for (int paced = 0; paced < 2; ++paced)
+	{
+		yb::replay_stream rp(log_ref, paced != 0);
+		uint64_t start = yb::clock_now_us();
+
+		assert(runner.run(rp.read(buf, 2)) == 2);
+		assert(runner.run(rp.read(buf + 2, sizeof buf)) == 3);
+		assert(std::equal(hello, hello + sizeof hello, buf));
+		runner.run(rp.write_all(ok, sizeof ok));
+
+		assert(runner.run(rp.read(buf, sizeof buf)) == 3);
+		assert(std::equal(bye, bye + sizeof bye, buf));
+		assert(yb::clock_now_us() - start == (paced? 2000: 0));
+
+		yb::task_result<size_t> r = runner.try_run(rp.read(buf, sizeof buf));
+		assert(r.has_error() && r.error() == yb::te_eof);
+		assert(rp.bytes_written() == sizeof ok);
+	}
+}
+
+TEST_CASE(StreamPair, "stream_pair")
+{
+	yb::sync_runner runner;
+	yb::stream_pair pair(16);
+	yb::stream & a = pair.first();
+	yb::stream & b = pair.second();
+
+	std::vector<uint8_t> data(100), out(100);
+	for (size_t i = 0; i < data.size(); ++i)
+		data[i] = (uint8_t)i;
+
+	// The transfers take turns waiting for the small rings.
+	runner.run(a.write_all(data.data(), data.size()) | b.read_all(out.data(), out.size()));
+	assert(out == data);
+	runner.run(b.write_all(data.data(), data.size()) | a.read_all(out.data(), out.size()));
+	assert(out == data);
+
+	// Transfers that needn't wait don't allocate.
+	size_t allocs = get_total_alloc_count();
+	for (int i = 0; i < 10; ++i)
+	{
+		yb::task<size_t> w = a.write(data.data(), 10);
+		yb::task<size_t> r = b.read(out.data(), out.size());
+		assert(w.has_result() && r.has_result() && r.get_result().get() == 10);
+	}
+	assert(get_total_alloc_count() == allocs);
+
+	pair.first().shutdown_write();
+	yb::task_result<size_t> eof = runner.try_run(b.read(out.data(), out.size()));
+	assert(eof.has_error() && eof.error() == yb::te_eof);
+
+	// A slow link delays the data by the latency and the time
+	// it takes to send them.
+	yb::virtual_clock clock(1000);
+	yb::virtual_clock_scope clock_scope(clock);
+	pair.second().set_link(500, 100000);
+
+	runner.run(b.write_all(data.data(), 10));
+	assert(runner.run(a.read(out.data(), out.size())) == 10);
+	assert(yb::clock_now_us() == 1000 + 100 + 500);
+}
+
+TEST_CASE(TeeStream, "tee_stream stream_pair")
+{
+	yb::sync_runner runner;
+	yb::stream_pair source(64), blocking(4), dropping(8), sampling(64);
+
+	yb::tee_stream tee(source.second());
+	tee.add_sink(blocking.first(), yb::tp_block);
+	size_t dropper = tee.add_sink(dropping.first(), yb::tp_drop);
+	tee.add_sink(sampling.first(), yb::tp_sample, 2);
+
+	uint8_t const data[] = "0123456789abcde";
+	uint8_t buf[16], out[16];
+	for (size_t i = 0; i < 3; ++i)
+	{
+		runner.run(source.first().write_all(data + 5 * i, 5));
+
+		// The read waits for the blocking sink to take the chunk.
+		runner.run(tee.read(buf, sizeof buf).then([&buf, &data, i](size_t r) {
+			assert(r == 5 && std::equal(buf, buf + 5, data + 5 * i));
+		}) | blocking.second().read_all(out, 5));
+		assert(std::equal(out, out + 5, data + 5 * i));
+	}
+
+	// The third chunk found the dropping sink still busy.
+	assert(tee.dropped_bytes(dropper) == 5 && !tee.sink_failed(dropper));
+	runner.run(tee.flush() | dropping.second().read_all(out, 10));
+	assert(std::equal(out, out + 10, data));
+
+	runner.run(sampling.second().read_all(out, 10));
+	assert(std::equal(out, out + 5, data) && std::equal(out + 5, out + 10, data + 10));
+}
+
+TEST_CASE(MeteredStream, "metered_stream stream_pair")
+{
+	yb::virtual_clock clock(1000);
+	yb::virtual_clock_scope clock_scope(clock);
+	yb::sync_runner runner;
+
+	yb::stream_pair pair(64);
+	yb::metered_stream m(pair.first());
+	pair.second().set_link(300);
+
+	uint8_t const data[] = "0123456789";
+	uint8_t buf[16];
+	runner.run(m.write_all(data, 10));
+	runner.run(pair.second().write_all(data, 4));
+	assert(runner.run(m.read(buf, sizeof buf)) == 4);
+
+	yb::stream_stats st = m.stats();
+	assert(st.writes == 1 && st.bytes_written == 10 && st.reads == 1 && st.bytes_read == 4);
+	assert(st.in_flight == 0 && st.max_in_flight == 1);
+	assert(st.write_size.counts[yb::log_histogram::bucket(10)] == 1);
+	assert(st.write_latency_us.counts[0] == 1);
+	assert(st.read_latency_us.quantile_floor(0.5) == 256);
+
+	m.reset_stats();
+	assert(m.stats().reads == 0);
+}
+
+TEST_CASE(PacedStream, "paced_stream stream_pair")
+{
+	yb::virtual_clock clock(1000);
+	yb::virtual_clock_scope clock_scope(clock);
+	yb::sync_runner runner;
+
+	yb::stream_pair pair;
+	yb::metered_stream meter(pair.first());
+	yb::paced_stream paced(meter, 1000, 10);
+
+	// A full burst goes out right away, the rest at a millisecond
+	// per byte, in chunks as large as the bucket allows.
+	uint8_t data[25], out[25];
+	for (size_t i = 0; i < sizeof data; ++i)
+		data[i] = (uint8_t)i;
+	runner.run(paced.write_all(data, sizeof data));
+	assert(yb::clock_now_us() == 1000 + 15000);
+	assert(meter.stats().writes == 3);
+
+	runner.run(pair.second().read_all(out, sizeof out));
+	assert(std::equal(data, data + sizeof data, out));
+}
+
+TEST_CASE(StreamParser, "stream_parser")
+{
+	// Noise, an empty packet, and a packet split across two reads.
+	uint8_t const input[] = { 0x12, 0x7f, 0x80, 0x30, 0x55, 0x80, 0x23, 0x80, 0xaa };
+	uint8_t const rest[] = { 0xbb, 0x01 };
+
+	yb::stream_parser parser;
+	std::vector<yb::packet> out;
+	parser.parse(out, input);
+	assert(out.size() == 1 && out[0] == yb::packet(1, 3));
+
+	parser.parse(out, rest);
+	assert(out.size() == 2 && out[1].size() == 4);
+	assert(out[1][0] == 2 && out[1][1] == 0x80 && out[1][2] == 0xaa && out[1][3] == 0xbb);
+}
+
+TEST_CASE(SlicedStreamParser, "stream_parser buffer_chain")
+{
+	uint8_t const input[] = { 0x12, 0x7f, 0x80, 0x30, 0x55, 0x80, 0x23, 0x80, 0xaa };
+	uint8_t const rest[] = { 0xbb, 0x01 };
+
+	yb::buffer_pool pool(16, 2);
+	yb::buffer_slice first = pool.copy(input);
+	yb::buffer_slice second = pool.copy(rest);
+
+	yb::stream_parser parser;
+	std::vector<yb::sliced_packet> out;
+	parser.parse(out, first);
+	assert(out.size() == 1 && out[0].command == 3 && out[0].payload.empty());
+
+	// The payload points into both read buffers rather than a copy.
+	parser.parse(out, second);
+	assert(out.size() == 2 && out[1].command == 2 && out[1].payload.size() == 3);
+	assert(out[1].payload.segment_count() == 2);
+	assert(out[1].payload.segment(0).data() == first.data() + 7);
+	assert(out[1].payload.segment(1).data() == second.data());
+	assert(out[1].payload[0] == 0x80 && out[1].payload[1] == 0xaa && out[1].payload[2] == 0xbb);
+}
+
+#ifndef _WIN32
+TEST_CASE(EmbeddedRunner, "embedded_runner")
+{
+	yb::embedded_runner runner;
+	yb::timer tmr;
+	yb::channel<int> ch = yb::channel<int>::create();
+
+	int received = 0;
+	bool timed_out = false;
+	runner.post_detached(ch.receive().then([&](int v) { received = v; }));
+	runner.post_detached(tmr.wait_ms(1).then([&] {
+		timed_out = true;
+		return ch.send(42);
+	}));
+
+	// Stand-in for the foreign event loop.
+	while (!runner.empty())
+	{
+		struct pollfd pfd = {};
+		pfd.fd = runner.native_handle();
+		pfd.events = POLLIN;
+		int r = poll(&pfd, 1, 1000);
+		assert(r == 1);
+		(void)r;
+		runner.dispatch_ready();
+	}
+
+	assert(timed_out);
+	assert(received == 42);
+}
+
+TEST_CASE(OffloadTask, "offload")
+{
+	yb::thread_pool pool(2);
+
+	int res = yb::sync_runner().run(yb::offload(pool, [] { return 42; }));
+	assert(res == 42);
+
+	yb::task_result<void> r = yb::sync_runner().try_run(yb::offload(pool, [] {
+		throw std::runtime_error("offloaded failure");
+	}));
+	assert(r.has_exception());
+}
+
+TEST_CASE(EmbeddedRunnerReusedFd, "embedded_runner offload")
+{
+	yb::embedded_runner runner;
+	yb::thread_pool pool(1);
+
+	// Each job waits on an eventfd of its own; the second one
+	// is likely to get the number the first one just closed.
+	int done = 0;
+	runner.post_detached(yb::offload(pool, [] { return 1; }).then([&](int v) {
+		done += v;
+		return yb::offload(pool, [] { return 2; });
+	}).then([&](int v) { done += v; }));
+
+	// A regular file can't be watched by epoll, but it's always ready.
+	char tmpl[] = "/tmp/libyb-test-XXXXXX";
+	yb::detail::scoped_unix_fd file(mkstemp(tmpl));
+	assert(!file.empty());
+	unlink(tmpl);
+	runner.post_detached(yb::make_linux_pollfd_task(file.get(), POLLIN, [](yb::cancel_level) { return true; })
+		.then([&](short) { done += 4; }));
+
+	for (int i = 0; i < 1000 && !runner.empty(); ++i)
+	{
+		struct pollfd pfd = {};
+		pfd.fd = runner.native_handle();
+		pfd.events = POLLIN;
+		poll(&pfd, 1, 1000);
+		runner.dispatch_ready();
+	}
+
+	assert(runner.empty() && done == 7);
+}
+
+TEST_CASE(FdStream, "fd_stream")
+{
+	yb::sync_runner runner;
+
+	int fds[2];
+	int r = socketpair(AF_UNIX, SOCK_STREAM, 0, fds);
+	assert(r == 0);
+	(void)r;
+
+	yb::fd_stream a(fds[0]);
+	yb::fd_stream b(fds[1]);
+
+	// The read waits until the write makes the data available.
+	uint8_t buf[4] = {};
+	yb::task<void> rd = b.read_all(buf, sizeof buf);
+	assert(rd.has_task());
+	uint8_t const data[] = { 1, 2, 3, 4 };
+	runner.run(a.write_all(data, sizeof data) | std::move(rd));
+	assert(std::equal(buf, buf + sizeof buf, data));
+
+	// Half-close: the peer sees the end of the stream and can still answer.
+	a.shutdown_write();
+	yb::task_result<size_t> eof = runner.try_run(b.read(buf, sizeof buf));
+	assert(eof.has_error() && eof.error() == yb::te_eof);
+	assert(a.write(data, 1).get_result().error() == yb::te_eof);
+
+	runner.run(b.write_all(data, 2));
+	runner.run(a.read_all(buf, 2));
+	assert(buf[0] == 1 && buf[1] == 2);
+
+	// A pipe pair works as one stream.
+	int p[2];
+	r = pipe(p);
+	assert(r == 0);
+	yb::fd_stream pipe_stream(p[0], p[1]);
+	runner.run(pipe_stream.write_all(data, sizeof data));
+	runner.run(pipe_stream.read_all(buf, sizeof buf));
+	assert(std::equal(buf, buf + sizeof buf, data));
+	pipe_stream.shutdown_write();
+	assert(runner.try_run(pipe_stream.read(buf, 1)).error() == yb::te_eof);
+
+	// Header and payload go out in a single call.
+	yb::buffer_ref out[] = { yb::buffer_ref(data, 1), yb::buffer_ref(data + 1, 3) };
+	assert(runner.run(b.writev(out, 2)) == 4);
+
+	uint8_t head[2], tail[2];
+	yb::read_segment in[] = { { head, sizeof head }, { tail, sizeof tail } };
+	assert(runner.run(a.readv(in, 2)) == 4);
+	assert(std::equal(head, head + 2, data) && std::equal(tail, tail + 2, data + 2));
+}
+
+TEST_CASE(FdStreamFastPath, "fd_stream")
+{
+	yb::sync_runner runner;
+
+	int fds[2];
+	int r = socketpair(AF_UNIX, SOCK_STREAM, 0, fds);
+	assert(r == 0);
+	(void)r;
+
+	yb::fd_stream a(fds[0]);
+	yb::fd_stream b(fds[1]);
+
+	// Transfers that don't block complete in place without allocating.
+	uint8_t const data[] = { 1, 2, 3, 4 };
+	uint8_t buf[4];
+	size_t allocs = get_total_alloc_count();
+	yb::task<size_t> w = a.write(data, sizeof data);
+	yb::task<size_t> rd = b.read(buf, sizeof buf);
+	assert(w.has_result() && rd.has_result());
+	assert(get_total_alloc_count() == allocs);
+	assert(rd.get_result().get() == 4);
+
+	// A read that would block takes a single allocation.
+	allocs = get_total_alloc_count();
+	rd = b.read(buf, sizeof buf);
+	assert(rd.has_task() && get_total_alloc_count() == allocs + 1);
+
+	runner.run(a.write_all(data, sizeof data));
+	assert(runner.run(std::move(rd)) == 4);
+}
+
+TEST_CASE(PipelinedCopy, "copy fd_stream")
+{
+	std::vector<uint8_t> data(100000);
+	for (size_t i = 0; i < data.size(); ++i)
+		data[i] = (uint8_t)(i * 7);
+
+	auto until_eof = [](yb::task_result<void> r) {
+		assert(r.has_error() && r.error() == yb::te_eof);
+		return yb::async::value();
+	};
+
+	yb::sync_runner runner;
+
+	int src[2], dst[2], p[2];
+	int r = socketpair(AF_UNIX, SOCK_STREAM, 0, src);
+	r |= socketpair(AF_UNIX, SOCK_STREAM, 0, dst);
+	r |= pipe(p);
+	assert(r == 0);
+	(void)r;
+
+	yb::fd_stream src_writer(src[0]), src_reader(src[1]);
+	yb::fd_stream dst_writer(dst[0]), dst_reader(dst[1]);
+	yb::fd_stream pipe_stream(p[0], p[1]);
+
+	// Sockets can't be spliced to each other; the data go
+	// through the ring of buffers.
+	assert(dst_writer.splice_from(src_reader, 4096).empty());
+
+	std::vector<uint8_t> out(data.size());
+	runner.run(
+		src_writer.write_all(data.data(), data.size()).then([&src_writer] { src_writer.shutdown_write(); })
+		| yb::copy(dst_writer, src_reader, 4096, 4).continue_with(until_eof)
+		| dst_reader.read_all(out.data(), out.size()));
+	assert(out == data);
+
+	// A pipe is spliced to the socket.
+	std::fill(out.begin(), out.end(), 0);
+	runner.run(
+		pipe_stream.write_all(data.data(), data.size()).then([&pipe_stream] { pipe_stream.shutdown_write(); })
+		| yb::copy(dst_writer, pipe_stream, 4096).continue_with(until_eof)
+		| dst_reader.read_all(out.data(), out.size()));
+	assert(out == data);
+}
+
+TEST_CASE(SocketBridge, "socket_stream")
+{
+	int fds[2];
+	int r = socketpair(AF_UNIX, SOCK_STREAM, 0, fds);
+	assert(r == 0);
+	(void)r;
+
+	// The device end is served to socket clients through a bridge.
+	yb::fd_stream device(fds[0]);
+	yb::fd_stream device_side(fds[1]);
+
+	yb::socket_acceptor tcp;
+	tcp.listen_tcp("127.0.0.1", 0);
+	yb::socket_acceptor local;
+	std::string path = "/tmp/libyb-test-" + std::to_string(getpid()) + ".sock";
+	local.listen_unix(path);
+
+	auto on_client = [&device](std::shared_ptr<yb::socket_stream> s) {
+		return yb::bridge(*s, device).follow_with([s] {});
+	};
+
+	yb::sync_runner runner;
+	yb::sync_future<void> server = runner.post(yb::serve(tcp, on_client) | yb::serve(local, on_client));
+
+	uint8_t const ping[] = { 'p', 'i', 'n', 'g' };
+	uint8_t const pong[] = { 'p', 'o', 'n', 'g' };
+	uint8_t buf[4];
+
+	for (int i = 0; i < 2; ++i)
+	{
+		yb::socket_stream client;
+		runner.run(i == 0? client.connect_tcp("127.0.0.1", tcp.local_port()): client.connect_unix(path));
+
+		runner.run(client.write_all(ping, sizeof ping));
+		runner.run(device_side.read_all(buf, sizeof buf));
+		assert(std::equal(buf, buf + sizeof buf, ping));
+
+		runner.run(device_side.write_all(pong, sizeof pong));
+		runner.run(client.read_all(buf, sizeof buf));
+		assert(std::equal(buf, buf + sizeof buf, pong));
+	}
+
+	server.get(yb::cl_abort);
+}
+
+TEST_CASE(UnixConnectBacklog, "socket_stream")
+{
+	yb::socket_acceptor local;
+	std::string path = "/tmp/libyb-test-backlog-" + std::to_string(getpid()) + ".sock";
+	local.listen_unix(path, 0);
+
+	// The clients outnumber the backlog until the server starts accepting.
+	size_t const count = 8;
+	std::vector<std::unique_ptr<yb::socket_stream> > clients;
+	size_t connected = 0;
+	yb::task<void> connects;
+	for (size_t i = 0; i < count; ++i)
+	{
+		clients.push_back(std::unique_ptr<yb::socket_stream>(new yb::socket_stream()));
+		connects |= clients.back()->connect_unix(path).then([&connected] { ++connected; });
+	}
+
+	yb::socket_stream accepted[count];
+	size_t accepted_count = 0;
+	yb::timer tmr;
+	yb::sync_runner runner;
+	runner.run(std::move(connects) | tmr.wait_ms(5).then([&] {
+		return yb::loop([&](yb::cancel_level) -> yb::task<void> {
+			if (accepted_count == count)
+				return yb::nulltask;
+			return local.accept(accepted[accepted_count++]);
+		});
+	}));
+	assert(connected == count && accepted_count == count);
+}
+#endif
+
 int main(int argc, char * argv[])
 {
 	run_tests(argc, argv);
@@ -2,6 +2,6 @@ TEMPLATE = app
 CONFIG += console
 CONFIG -= qt
 
-SOURCES += main.cpp test.cpp memmock.cpp shupito_flash.cpp
+SOURCES += main.cpp test.cpp memmock.cpp shupito_flash.cpp bench.cpp
 
 include(../libyb.pri)